@@ -9,12 +9,40 @@
 #include <ext.hpp>
 #include <filesystem>
 #include "lsystem.h"
+#include "geometry.h"
+#include "tubes.h"
 
 /*Program Status variables*/
 //vertex buffer objects ids
-unsigned int vertexArrayObjID[1];
-unsigned int vertexBufferObjID[1];
-GLint number_of_vertices, program, windowId;
+unsigned int vertexArrayObjID[3]; //lines, tubes, triangles
+unsigned int vertexBufferObjID[5]; //line vertices, cylinder, tube instances, triangle vertices, line vertex attributes
+unsigned int indexBufferObjID[2]; //lines, cylinder
+GLint number_of_vertices, program, tube_program, windowId;
+GLint number_of_indices; //0 when the vertices are drawn in order
+GLenum index_mode; //GL_LINES or GL_LINE_STRIP
+GLint number_of_tubes, number_of_cylinder_indices, number_of_triangle_vertices; //tubes replace the lines, triangles are drawn with them
+//options used when an L-System has to be generated
+LSGenOptions generation_options;
+
+//off, all or a comma separated list of depth, width and color
+bool parseAttributes(const std::string &value, unsigned int *attributes) {
+	*attributes = value == "all" ? ATTRIBUTE_ALL : 0;
+	if (value == "off" || value == "all")
+		return true;
+	std::istringstream names(value);
+	std::string name;
+	while (std::getline(names, name, ',')) {
+		if (name == "depth")
+			*attributes |= ATTRIBUTE_DEPTH;
+		else if (name == "width")
+			*attributes |= ATTRIBUTE_WIDTH;
+		else if (name == "color")
+			*attributes |= ATTRIBUTE_COLOR;
+		else
+			return false;
+	}
+	return true;
+}
 
 /*show all the saved files*/
 void printSavedFilesName() {
@@ -103,38 +131,98 @@ std::array<std::pair<GLfloat, GLfloat>, 3> getEncasingSquareCoords(const GLfloat
 }
 
 
-GLfloat *loadData(std::string filename, GLuint &size) {
-	
-	GLfloat *vertices = (GLfloat*)loadFile(filename, size);
-	if (vertices == NULL)
-		return NULL;
-	//initialize global variable
-	number_of_vertices = size / (3 * sizeof(GLfloat));
-	return vertices;
+//reads plain vertex files and indexed geometry files
+bool loadData(std::string filename, Geometry &geometry) {
+	if (!readGeometry(filename, &geometry) || geometry.vertices.empty()) {
+		std::cout << "Unable to open file " << filename << std::endl;
+		return false;
+	}
+	std::cout << "file " << filename << " loaded" << std::endl;
+	//initialize global variables
+	number_of_vertices = (GLint)geometry.vertices.size();
+	number_of_indices = (GLint)(geometry.strips.empty() ? geometry.lines.size() : geometry.strips.size());
+	index_mode = geometry.strips.empty() ? GL_LINES : GL_LINE_STRIP;
+	number_of_tubes = (GLint)geometry.tubes.size();
+	number_of_triangle_vertices = (GLint)geometry.triangles.size();
+	return true;
 }
 
 //initialization of the buffers
 void genBuffers() {
 	// Allocate Vertex Array Objects
-	glGenVertexArrays(1, vertexArrayObjID);
+	glGenVertexArrays(3, vertexArrayObjID);
 	// Setup first Vertex Array Object
 	glBindVertexArray(vertexArrayObjID[0]);
-	glGenBuffers(1, vertexBufferObjID);
+	glGenBuffers(5, vertexBufferObjID);
+	glGenBuffers(2, indexBufferObjID);
 
 	// VBO for vertex data
 	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObjID[0]);
 	glVertexAttribPointer((GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, 0);
 	glEnableVertexAttribArray(0);	
+	// VBO for the packed attributes: depth and color index as normalized bytes, enabled when the geometry has them
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObjID[4]);
+	glVertexAttribPointer((GLuint)1, 2, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(VertexAttributes), (const void*)offsetof(VertexAttributes, depth));
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// index buffer, part of the VAO state
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferObjID[0]);
 	glBindVertexArray(0);
+	// line strips are separated by the restart index
+	glEnable(GL_PRIMITIVE_RESTART);
+	glPrimitiveRestartIndex(STRIP_RESTART);
+
+	// tubes: the cylinder mesh, drawn once per instance with the start, end and radius of its tube
+	std::vector<std::array<float, 3>> cylinder;
+	std::vector<uint32_t> cylinder_indices;
+	cylinderMesh(TubeOptions().sides, &cylinder, &cylinder_indices);
+	number_of_cylinder_indices = (GLint)cylinder_indices.size();
+	glBindVertexArray(vertexArrayObjID[1]);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObjID[1]);
+	glBufferData(GL_ARRAY_BUFFER, cylinder.size() * sizeof(std::array<float, 3>), cylinder.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer((GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferObjID[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, cylinder_indices.size() * sizeof(uint32_t), cylinder_indices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObjID[2]);
+	glVertexAttribPointer((GLuint)2, 3, GL_FLOAT, GL_FALSE, sizeof(TubeInstance), (const void*)offsetof(TubeInstance, start));
+	glVertexAttribPointer((GLuint)3, 3, GL_FLOAT, GL_FALSE, sizeof(TubeInstance), (const void*)offsetof(TubeInstance, end));
+	glVertexAttribPointer((GLuint)4, 1, GL_FLOAT, GL_FALSE, sizeof(TubeInstance), (const void*)offsetof(TubeInstance, radius));
+	for (GLuint attribute = 2; attribute <= 4; attribute++) {
+		glEnableVertexAttribArray(attribute);
+		glVertexAttribDivisor(attribute, 1);
+	}
+	// triangles
+	glBindVertexArray(vertexArrayObjID[2]);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObjID[3]);
+	glVertexAttribPointer((GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	glEnable(GL_DEPTH_TEST);
 }
 
-void fillBuffers(const GLfloat *vertices, const GLuint vertices_size) {
+void fillBuffers(const Geometry &geometry) {
 	glBindVertexArray(vertexArrayObjID[0]);
 	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObjID[0]);
-	glBufferData(GL_ARRAY_BUFFER, vertices_size, vertices, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, geometry.vertices.size() * sizeof(std::array<float, 3>), geometry.vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObjID[4]);
+	glBufferData(GL_ARRAY_BUFFER, geometry.attributes.size() * sizeof(VertexAttributes), geometry.attributes.data(), GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// without attributes every vertex reads depth 0 and color 0, plain green
+	if (geometry.attributes.empty()) {
+		glDisableVertexAttribArray(1);
+		glVertexAttrib2f(1, 0.0f, 0.0f);
+	}
+	else
+		glEnableVertexAttribArray(1);
+	const std::vector<uint32_t> &indices = geometry.strips.empty() ? geometry.lines : geometry.strips;
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
 	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObjID[2]);
+	glBufferData(GL_ARRAY_BUFFER, geometry.tubes.size() * sizeof(TubeInstance), geometry.tubes.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObjID[3]);
+	glBufferData(GL_ARRAY_BUFFER, geometry.triangles.size() * sizeof(std::array<float, 3>), geometry.triangles.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 //ViewModelProjection matrix initialization to have it perpendicular to the XY plane, looking at the middle point of the L system
@@ -151,29 +239,33 @@ void initMatrices(const GLfloat *vertices, const GLuint size) {
 
 
  	glm::mat4 ProjectionMatrix = glm::perspective(static_cast<float>(glm::radians(45.0f)), 600.0f / 600.0f, 0.1f, 100.0f);
-	glm::mat4 ViewMatrix = glm::lookAt(glm::vec3(middle_point.at(0), middle_point.at(1), 15.0f),
-										glm::vec3(middle_point.at(0), middle_point.at(1), middle_point.at(2)),
+	glm::mat4 ViewMatrix = glm::lookAt(glm::vec3(0.0f, 0.0f, 15.0f),
+										glm::vec3(0.0f, 0.0f, 0.0f),
 										glm::vec3(0.0f, 1.0f, 0.0f));
 
+	//the L system is centered and scaled to a box of side 10, flat along z for planar ones
 	glm::mat4 ScalingMatrix = glm::mat4(glm::vec4(10.0f / max_distances.at(0), 0.0f, 0.0f, 0.0f),
 										glm::vec4(0.0f, 10.0f/max_distances.at(1), 0.0f, 0.0f),
-										glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+										glm::vec4(0.0f, 0.0f, max_distances.at(2) > 0.0f ? 10.0f / max_distances.at(2) : 1.0f, 0.0f),
 										glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	glm::mat4 ModelMatrix = ScalingMatrix * glm::translate(glm::mat4(1.0f), -glm::vec3(middle_point.at(0), middle_point.at(1), middle_point.at(2)));
 	
-	glm::mat4 mvp = ProjectionMatrix * ScalingMatrix * ViewMatrix;
-	GLint uniMvp = glGetUniformLocation(program, "mvp");
-	glUniformMatrix4fv(uniMvp, 1, GL_FALSE, glm::value_ptr(mvp));
+	glm::mat4 mvp = ProjectionMatrix * ViewMatrix * ModelMatrix;
+	for (const GLint shaders : { tube_program, program }) {
+		glUseProgram(shaders);
+		GLint uniMvp = glGetUniformLocation(shaders, "mvp");
+		glUniformMatrix4fv(uniMvp, 1, GL_FALSE, glm::value_ptr(mvp));
+	}
 }
 
-void initShaders()
+//compiles and links the program of two shader files
+GLint createProgram(const char *vertexShader, const char *fragShader)
 {
 	GLuint v = glCreateShader(GL_VERTEX_SHADER);
 	GLuint f = glCreateShader(GL_FRAGMENT_SHADER);
 
 	// load shaders & get length of each
 	GLuint vlen, flen;
-	char vertexShader[] = "minimal.vert";
-	char fragShader[] = "minimal.frag";
 	char* vs = loadFile(vertexShader, vlen);
 	char* fs = loadFile(fragShader, flen);
 
@@ -206,60 +298,84 @@ void initShaders()
 	GLint p = glCreateProgram();
 
 	glBindAttribLocation(p, 0, "in_Position");
-	glBindAttribLocation(p, 1, "in_Color");
+	glBindAttribLocation(p, 1, "in_Attributes");
+	glBindAttribLocation(p, 2, "in_Start");
+	glBindAttribLocation(p, 3, "in_End");
+	glBindAttribLocation(p, 4, "in_Radius");
 	glAttachShader(p, v);
 	glAttachShader(p, f);
 
 	glLinkProgram(p);
-	glUseProgram(p);
 
 	delete[] vs; // dont forget to free allocated memory
 	delete[] fs; // we allocated this in the loadFile function...
-	//global variable
-	program = p;
+	return p;
+}
+
+void initShaders()
+{
+	//global variables
+	tube_program = createProgram("tube.vert", "tube.frag");
+	program = createProgram("minimal.vert", "minimal.frag");
+	glUseProgram(program);
 }
 
 
 void loadLSystem(unsigned int choice, unsigned int numberOfInterations)
 {
-	GLuint vertices_size = 0;
+	Geometry geometry;
 	std::string filename = "saved_files/" + getLSystemFileName((LSystemCode)choice, numberOfInterations);
-	GLfloat *vertices = NULL;
+	bool loaded = false;
 	
 	if(choice != 0)
-		vertices = loadData(filename, vertices_size);
+		loaded = loadData(filename, geometry);
 	
-	if(vertices == NULL){ //found no default filename
+	if(!loaded){ //found no default filename
 		//generate data points
 		//choise of l system and number of iterations
-		lsGenData(choice, numberOfInterations, "saved_files/default.bin");
-		vertices = loadData("saved_files/default.bin", vertices_size);
-		if (vertices == NULL)
+		if (!lsGenData(choice, numberOfInterations, "saved_files/default.bin", generation_options))
+			return;
+		if (!loadData("saved_files/default.bin", geometry))
 			return;
 	}
-	fillBuffers(vertices, vertices_size);
-	initMatrices(vertices, vertices_size);
+	fillBuffers(geometry);
+	initMatrices((const GLfloat*)geometry.vertices.data(), (GLuint)(geometry.vertices.size() * sizeof(std::array<float, 3>)));
 	glutPostRedisplay();
 }
 
 void loadLSystemFile(std::string filename) {
-	GLuint vertices_size = 0;
-	GLfloat *vertices = loadData(filename, vertices_size);
-	if (vertices == NULL)
+	Geometry geometry;
+	if (!loadData(filename, geometry))
 		return;
 
-	fillBuffers(vertices, vertices_size);
-	initMatrices(vertices, vertices_size);
+	fillBuffers(geometry);
+	initMatrices((const GLfloat*)geometry.vertices.data(), (GLuint)(geometry.vertices.size() * sizeof(std::array<float, 3>)));
 	glutPostRedisplay();
 }
 
 void display()
 {
 	// clear the screen
-	glClear(GL_COLOR_BUFFER_BIT);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	
-	glBindVertexArray(vertexArrayObjID[0]);	// First VAO
-	glDrawArrays(GL_LINES, 0, number_of_vertices);
+	// leaves and tubes tessellated for export, all in a single draw
+	if (number_of_triangle_vertices > 0) {
+		glBindVertexArray(vertexArrayObjID[2]);
+		glDrawArrays(GL_TRIANGLES, 0, number_of_triangle_vertices);
+	}
+	if (number_of_tubes > 0) {
+		glUseProgram(tube_program);
+		glBindVertexArray(vertexArrayObjID[1]);
+		glDrawElementsInstanced(GL_TRIANGLES, number_of_cylinder_indices, GL_UNSIGNED_INT, 0, number_of_tubes);
+		glUseProgram(program);
+	}
+	else {
+		glBindVertexArray(vertexArrayObjID[0]);	// First VAO
+		if (number_of_indices > 0)
+			glDrawElements(index_mode, number_of_indices, GL_UNSIGNED_INT, 0);
+		else
+			glDrawArrays(GL_LINES, 0, number_of_vertices);
+	}
 	glBindVertexArray(0);
 
 	glutSwapBuffers();
@@ -285,6 +401,7 @@ void processInput(std::string *input) {
 			std::cout << "To load a saved L-System: 'load filename'" << std::endl;
 			std::cout << "To list the name of the saved L-System: 'list' or 'ls' (-s | -c)" << std::endl;
 			std::cout << "To delete a saved system: 'delete' or 'del' (filename)" << std::endl;
+			std::cout << "To change how L-Systems are generated: 'set' (derivation eager|lazy|dag|kstep|packed|rle), (seed number), (fused on|off), (pipeline on|off), (indexed on|off), (strips on|off), (merge on|off), (tubes on|off|mesh), (polygons on|off), (compiled on|off) or (attributes off|all|depth,width,color)" << std::endl;
 			std::cout << "To quit the program: 'exit' or 'quit'" << std::endl;
 			
 		}
@@ -360,6 +477,49 @@ void processInput(std::string *input) {
 			else
 				std::cout << "INPUT ERROR: MISSING FILENAME TAG" << std::endl;
 		}
+		else if (token == "set") {
+			std::string option, value;
+			unsigned int attributes;
+			input_stream >> option >> value;
+			if (!input_stream.fail()) {
+				if (option == "derivation" && value == "eager")
+					generation_options.derivation = DERIVE_EAGER;
+				else if (option == "derivation" && value == "lazy")
+					generation_options.derivation = DERIVE_LAZY;
+				else if (option == "derivation" && value == "dag")
+					generation_options.derivation = DERIVE_DAG;
+				else if (option == "derivation" && value == "kstep")
+					generation_options.derivation = DERIVE_KSTEP;
+				else if (option == "derivation" && value == "packed")
+					generation_options.derivation = DERIVE_PACKED;
+				else if (option == "derivation" && value == "rle")
+					generation_options.derivation = DERIVE_RLE;
+				else if (option == "seed" && value.find_first_not_of("0123456789") == std::string::npos && value.size() <= 19)
+					generation_options.seed = std::stoull(value);
+				else if (option == "fused" && (value == "on" || value == "off"))
+					generation_options.fused = value == "on";
+				else if (option == "pipeline" && (value == "on" || value == "off"))
+					generation_options.pipelined = value == "on";
+				else if (option == "indexed" && (value == "on" || value == "off"))
+					generation_options.indexed = value == "on";
+				else if (option == "merge" && (value == "on" || value == "off"))
+					generation_options.merge_collinear = value == "on";
+				else if (option == "strips" && (value == "on" || value == "off"))
+					generation_options.strips = value == "on";
+				else if (option == "tubes" && (value == "on" || value == "off" || value == "mesh"))
+					generation_options.tubes = value == "on" ? TUBES_INSTANCED : (value == "mesh" ? TUBES_MESH : TUBES_OFF);
+				else if (option == "polygons" && (value == "on" || value == "off"))
+					generation_options.polygons = value == "on";
+				else if (option == "compiled" && (value == "on" || value == "off"))
+					generation_options.compiled = value == "on";
+				else if (option == "attributes" && parseAttributes(value, &attributes))
+					generation_options.attributes = attributes;
+				else
+					std::cout << "INPUT ERROR: UNKNOWN OPTION " << option << " " << value << std::endl;
+			}
+			else
+				std::cout << "INPUT ERROR: MISSING OPTION OR VALUE" << std::endl;
+		}
 		else if (token == "exit" || token == "quit") {
 			glutDestroyWindow(windowId);
 			glutLeaveMainLoop();
@@ -379,7 +539,7 @@ void loopTimer(int value) {
 int main(int argc, char* argv[]){
 	//initialize window
 	glutInit(&argc, argv);
-	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
+	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
 	glutInitWindowSize(600, 600);
 	windowId = glutCreateWindow("L-SYSTEMS");
 	glewInit();
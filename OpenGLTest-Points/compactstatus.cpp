@@ -0,0 +1,117 @@
+#include "compactstatus.h"
+using namespace std;
+
+/*SymbolAlphabet*/
+
+SymbolAlphabet::SymbolAlphabet(const string &axiom, const RuleMatcher &matcher) {
+	_codes.fill(-1);
+	for (const char &symbol : axiom)
+		add(symbol);
+	for (size_t i = 0; i < _symbols.size(); i++) {
+		const string *expansion = matcher.expansion((unsigned char)_symbols[i]);
+		if (expansion != nullptr) {
+			for (const char &symbol : *expansion)
+				add(symbol);
+		}
+	}
+}
+
+void SymbolAlphabet::add(const char symbol) {
+	if (_codes[(unsigned char)symbol] == -1) {
+		_codes[(unsigned char)symbol] = (int)_symbols.size();
+		_symbols.push_back(symbol);
+	}
+}
+
+/*PackedString*/
+
+PackedString::PackedString(const unsigned int bitsPerSymbol) {
+	_size = 0;
+	_bits = bitsPerSymbol;
+	_shift = bitsPerSymbol == 2 ? 5 : (bitsPerSymbol == 4 ? 4 : 3);
+}
+
+void PackedString::swap(PackedString &other) {
+	_words.swap(other._words);
+	std::swap(_size, other._size);
+	std::swap(_bits, other._bits);
+	std::swap(_shift, other._shift);
+}
+
+/*PackedRules*/
+
+PackedRules::PackedRules(const SymbolAlphabet &alphabet, const RuleMatcher &matcher) {
+	_expansions.resize(alphabet.size());
+	for (unsigned int code = 0; code < alphabet.size(); code++) {
+		const string *expansion = matcher.expansion((unsigned char)alphabet.symbol(code));
+		if (expansion == nullptr)
+			_expansions[code].push_back((unsigned char)code);
+		else {
+			for (const char &symbol : *expansion)
+				_expansions[code].push_back((unsigned char)alphabet.code(symbol));
+		}
+	}
+}
+
+void PackedRules::rewrite(const PackedString &current, PackedString &next) const {
+	current.forEach([&](const unsigned int code) {
+		for (const unsigned char &expanded : _expansions[code])
+			next.push_back(expanded);
+	});
+}
+
+/*RunString*/
+
+RunString::RunString() {
+	_length = 0;
+}
+
+RunString::RunString(const string &symbols) {
+	_length = 0;
+	for (const char &symbol : symbols)
+		append(symbol, 1);
+}
+
+void RunString::swap(RunString &other) {
+	_runs.swap(other._runs);
+	std::swap(_length, other._length);
+}
+
+/*RunRules*/
+
+RunRules::RunRules(const RuleMatcher &matcher) {
+	for (unsigned int symbol = 0; symbol < 256; symbol++) {
+		const string *expansion = matcher.expansion((unsigned char)symbol);
+		_has_rule[symbol] = expansion != nullptr;
+		if (expansion != nullptr)
+			_expansions[symbol] = RunString(*expansion).runs();
+	}
+}
+
+size_t RunRules::maxRuns(const RunString &current) const {
+	size_t runs = 0;
+	for (const SymbolRun &run : current.runs()) {
+		const vector<SymbolRun> &expansion = _expansions[(unsigned char)run.symbol];
+		runs += expansion.size() <= 1 ? 1 : (size_t)run.count * expansion.size();
+	}
+	return runs;
+}
+
+void RunRules::rewrite(const RunString &current, RunString &next) const {
+	next.reserve(next.runs().size() + maxRuns(current));
+	for (const SymbolRun &run : current.runs()) {
+		const unsigned char symbol = (unsigned char)run.symbol;
+		if (!_has_rule[symbol]) {
+			next.append(run.symbol, run.count);
+			continue;
+		}
+		const vector<SymbolRun> &expansion = _expansions[symbol];
+		if (expansion.size() == 1)
+			next.append(expansion[0].symbol, expansion[0].count * run.count);
+		else {
+			for (unsigned long long i = 0; i < run.count; i++)
+				for (const SymbolRun &expanded : expansion)
+					next.append(expanded.symbol, expanded.count);
+		}
+	}
+}
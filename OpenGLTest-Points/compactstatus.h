@@ -0,0 +1,121 @@
+#ifndef COMPACT_STATUS_H
+#define COMPACT_STATUS_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include "rulematcher.h"
+
+/*Interned alphabet*/
+//every symbol of the axiom and of the rules gets a small code, in order of first appearance
+class SymbolAlphabet {
+private:
+	std::string _symbols; //code -> symbol
+	std::array<int, 256> _codes; //symbol -> code, -1 if absent
+	void add(const char symbol);
+public:
+	SymbolAlphabet(const std::string &axiom, const RuleMatcher &matcher);
+	size_t size() const { return _symbols.size(); }
+	//2, 4 or 8 bits per symbol depending on the alphabet size
+	unsigned int bitsPerSymbol() const { return _symbols.size() <= 4 ? 2 : (_symbols.size() <= 16 ? 4 : 8); }
+	unsigned int code(const char symbol) const { return (unsigned int)_codes[(unsigned char)symbol]; }
+	char symbol(const unsigned int code) const { return _symbols[code]; }
+};
+
+/*Bit packed string*/
+//codes of bitsPerSymbol bits stored in 64 bit words, lowest bits first
+class PackedString {
+private:
+	std::vector<uint64_t> _words;
+	size_t _size;
+	unsigned int _bits, _shift; //_shift = log2 of the symbols per word
+public:
+	PackedString(const unsigned int bitsPerSymbol);
+
+	size_t size() const { return _size; }
+	size_t bytes() const { return _words.size() * sizeof(uint64_t); }
+	void clear() { _words.clear(); _size = 0; }
+	void reserve(const size_t symbols) { _words.reserve((symbols >> _shift) + 1); }
+	void swap(PackedString &other);
+
+	void push_back(const unsigned int code) {
+		const unsigned int offset = (unsigned int)(_size & ((1u << _shift) - 1));
+		if (offset == 0)
+			_words.push_back(0);
+		_words.back() |= (uint64_t)code << (offset * _bits);
+		_size++;
+	}
+	unsigned int at(const size_t index) const {
+		const unsigned int offset = (unsigned int)(index & ((1u << _shift) - 1));
+		return (unsigned int)(_words[index >> _shift] >> (offset * _bits)) & ((1u << _bits) - 1);
+	}
+	//calls visitor(code) for every code in order, decoding a whole word at a time
+	template<class Visitor> void forEach(Visitor &&visitor) const {
+		const uint64_t mask = (1ull << _bits) - 1;
+		const size_t perWord = (size_t)1 << _shift;
+		size_t remaining = _size;
+		for (const uint64_t &stored : _words) {
+			uint64_t word = stored;
+			const size_t count = remaining < perWord ? remaining : perWord;
+			for (size_t i = 0; i < count; i++, word >>= _bits)
+				visitor((unsigned int)(word & mask));
+			remaining -= count;
+		}
+	}
+};
+
+//context free rules translated to codes, rewrites a packed generation without unpacking it
+class PackedRules {
+private:
+	std::vector<std::vector<unsigned char>> _expansions; //code -> codes of its expansion
+public:
+	PackedRules(const SymbolAlphabet &alphabet, const RuleMatcher &matcher);
+	void rewrite(const PackedString &current, PackedString &next) const;
+};
+
+/*Run length encoded string*/
+//consecutive equal symbols are stored as a single (symbol, count) run, adjacent runs never share a symbol
+struct SymbolRun {
+	char symbol;
+	unsigned long long count;
+};
+
+class RunString {
+private:
+	std::vector<SymbolRun> _runs;
+	unsigned long long _length; //symbols, sum of the run counts
+public:
+	RunString();
+	RunString(const std::string &symbols);
+
+	const std::vector<SymbolRun> &runs() const { return _runs; }
+	unsigned long long length() const { return _length; }
+	void clear() { _runs.clear(); _length = 0; }
+	void reserve(const size_t runs) { _runs.reserve(runs); }
+	void swap(RunString &other);
+
+	void append(const char symbol, const unsigned long long count) {
+		if (count == 0)
+			return;
+		if (!_runs.empty() && _runs.back().symbol == symbol)
+			_runs.back().count += count;
+		else
+			_runs.push_back({ symbol, count });
+		_length += count;
+	}
+};
+
+//context free rules rewriting whole runs: a run of a symbol whose expansion is itself a single run,
+//like 1 -> 11 or F -> FF, stays a single run with its count multiplied
+class RunRules {
+private:
+	std::array<std::vector<SymbolRun>, 256> _expansions; //empty for symbols without rules
+	std::array<bool, 256> _has_rule;
+	size_t maxRuns(const RunString &current) const; //upper bound of the runs produced by rewrite
+public:
+	RunRules(const RuleMatcher &matcher);
+	void rewrite(const RunString &current, RunString &next) const;
+};
+
+#endif // !COMPACT_STATUS_H
@@ -0,0 +1,237 @@
+#include "derivation.h"
+#include <algorithm>
+#include <climits>
+using namespace std;
+
+/*SymbolStream*/
+
+SymbolStream::SymbolStream(const string &axiom, const RuleMatcher &matcher, const unsigned int numberOfIterations) {
+	_matcher = &matcher;
+	_axiom = axiom;
+	_stack.reserve(numberOfIterations + 1);
+	_stack.push_back({ _axiom.data(), _axiom.size(), 0, numberOfIterations });
+}
+
+/*DerivationDag*/
+
+DerivationDag::DerivationDag(const string &axiom, const RuleMatcher &matcher, const unsigned int numberOfIterations) {
+	_matcher = &matcher;
+	vector<unsigned int> children;
+	for (const char &symbol : axiom)
+		children.push_back(intern(symbol, numberOfIterations));
+	_root = addNode(false, 0, children);
+}
+
+unsigned int DerivationDag::addNode(const bool leaf, const char symbol, const vector<unsigned int> &children) {
+	Node node;
+	node.leaf = leaf;
+	node.symbol = symbol;
+	node.length = leaf ? 1 : 0;
+	node.first_child = (unsigned int)_children.size();
+	node.child_count = (unsigned int)children.size();
+	for (const unsigned int &child : children) {
+		node.length = _nodes[child].length > ULLONG_MAX - node.length ? ULLONG_MAX : node.length + _nodes[child].length;
+		_children.push_back(child);
+	}
+	_nodes.push_back(node);
+	return (unsigned int)_nodes.size() - 1;
+}
+
+unsigned int DerivationDag::intern(const char symbol, unsigned int depth) {
+	//a symbol without rules is the same leaf at any depth
+	const string *expansion = _matcher->expansion((unsigned char)symbol);
+	if (expansion == nullptr)
+		depth = 0;
+	const unsigned long long key = ((unsigned long long)depth << 8) | (unsigned char)symbol;
+	unordered_map<unsigned long long, unsigned int>::iterator found = _interned.find(key);
+	if (found != _interned.end())
+		return found->second;
+
+	vector<unsigned int> children;
+	if (depth > 0) {
+		for (const char &current : *expansion)
+			children.push_back(intern(current, depth - 1));
+	}
+	const unsigned int node = addNode(depth == 0, symbol, children);
+	_interned[key] = node;
+	return node;
+}
+
+char DerivationDag::symbolAt(unsigned long long index) const {
+	unsigned int current = _root;
+	while (!_nodes[current].leaf) {
+		const Node &node = _nodes[current];
+		for (unsigned int i = 0; i < node.child_count; i++) {
+			const unsigned int child = _children[node.first_child + i];
+			if (index < _nodes[child].length) {
+				current = child;
+				break;
+			}
+			index -= _nodes[child].length;
+		}
+	}
+	return _nodes[current].symbol;
+}
+
+void DerivationDag::write(ostream &stream) const {
+	constexpr size_t BLOCK_SIZE = 1 << 16;
+	string block;
+	block.reserve(BLOCK_SIZE);
+	traverse([&](const char symbol) {
+		block.push_back(symbol);
+		if (block.size() == BLOCK_SIZE) {
+			stream.write(block.data(), block.size());
+			block.clear();
+		}
+	});
+	stream.write(block.data(), block.size());
+}
+
+/*GrowthModel*/
+
+static unsigned long long saturatingAdd(const unsigned long long a, const unsigned long long b) {
+	return a > ULLONG_MAX - b ? ULLONG_MAX : a + b;
+}
+
+static unsigned long long saturatingMultiply(const unsigned long long a, const unsigned long long b) {
+	return (a != 0 && b > ULLONG_MAX / a) ? ULLONG_MAX : a * b;
+}
+
+//bracket depths can move in both directions, they are clamped well inside the long long range
+static long long clampedAdd(const long long a, const long long b) {
+	constexpr long long limit = LLONG_MAX / 4;
+	return max(-limit, min(limit, a + b));
+}
+
+GrowthModel::GrowthModel(const string &axiom, const RuleMatcher &matcher) {
+	_matcher = &matcher;
+	_axiom = axiom;
+	_index.fill(-1);
+	for (const char &symbol : axiom)
+		addSymbol(symbol);
+	//expansions may introduce new symbols, whose expansions are then scanned in turn
+	for (size_t i = 0; i < _alphabet.size(); i++) {
+		const string *expansion = matcher.expansion((unsigned char)_alphabet[i]);
+		if (expansion != nullptr) {
+			for (const char &symbol : *expansion)
+				addSymbol(symbol);
+		}
+	}
+
+	const size_t size = _alphabet.size();
+	_matrix.assign(size * size, 0);
+	for (size_t a = 0; a < size; a++) {
+		const string *expansion = matcher.expansion((unsigned char)_alphabet[a]);
+		if (expansion == nullptr)
+			_matrix[a * size + a] = 1;
+		else {
+			for (const char &symbol : *expansion)
+				_matrix[a * size + _index[(unsigned char)symbol]]++;
+		}
+	}
+}
+
+void GrowthModel::addSymbol(const char symbol) {
+	if (_index[(unsigned char)symbol] == -1) {
+		_index[(unsigned char)symbol] = (int)_alphabet.size();
+		_alphabet.push_back(symbol);
+	}
+}
+
+vector<unsigned long long> GrowthModel::multiply(const vector<unsigned long long> &a, const vector<unsigned long long> &b) const {
+	const size_t size = _alphabet.size();
+	vector<unsigned long long> product(size * size, 0);
+	for (size_t i = 0; i < size; i++)
+		for (size_t k = 0; k < size; k++) {
+			if (a[i * size + k] == 0)
+				continue;
+			for (size_t j = 0; j < size; j++)
+				product[i * size + j] = saturatingAdd(product[i * size + j], saturatingMultiply(a[i * size + k], b[k * size + j]));
+		}
+	return product;
+}
+
+//for every symbol keeps the net bracket balance of its expansion and the deepest prefix of it,
+//the values after k + 1 iterations follow from the ones after k by walking the rules once
+unsigned long long GrowthModel::maxDepth(const unsigned int numberOfIterations) const {
+	const size_t size = _alphabet.size();
+	vector<long long> balance(size, 0), deepest(size, 0);
+	for (size_t a = 0; a < size; a++) {
+		balance[a] = _alphabet[a] == '[' ? 1 : (_alphabet[a] == ']' ? -1 : 0);
+		deepest[a] = max(0ll, balance[a]);
+	}
+
+	auto fold = [&](const string &symbols, long long &foldBalance, long long &foldDeepest) {
+		foldBalance = 0, foldDeepest = 0;
+		for (const char &symbol : symbols) {
+			const int index = _index[(unsigned char)symbol];
+			foldDeepest = max(foldDeepest, clampedAdd(foldBalance, deepest[index]));
+			foldBalance = clampedAdd(foldBalance, balance[index]);
+		}
+	};
+
+	vector<long long> nextBalance(size), nextDeepest(size);
+	for (unsigned int i = 0; i < numberOfIterations; i++) {
+		for (size_t a = 0; a < size; a++) {
+			const string *expansion = _matcher->expansion((unsigned char)_alphabet[a]);
+			if (expansion == nullptr) {
+				nextBalance[a] = balance[a];
+				nextDeepest[a] = deepest[a];
+			}
+			else
+				fold(*expansion, nextBalance[a], nextDeepest[a]);
+		}
+		balance.swap(nextBalance);
+		deepest.swap(nextDeepest);
+	}
+
+	long long axiomBalance, axiomDeepest;
+	fold(_axiom, axiomBalance, axiomDeepest);
+	return (unsigned long long)axiomDeepest;
+}
+
+vector<unsigned long long> GrowthModel::counts(const unsigned int numberOfIterations) const {
+	const size_t size = _alphabet.size();
+	//power = M^n by repeated squaring
+	vector<unsigned long long> power(size * size, 0), base = _matrix;
+	for (size_t a = 0; a < size; a++)
+		power[a * size + a] = 1;
+	for (unsigned int exponent = numberOfIterations; exponent > 0; exponent >>= 1) {
+		if (exponent & 1)
+			power = multiply(power, base);
+		if (exponent > 1)
+			base = multiply(base, base);
+	}
+
+	vector<unsigned long long> result(size, 0);
+	for (const char &symbol : _axiom) {
+		const size_t a = _index[(unsigned char)symbol];
+		for (size_t b = 0; b < size; b++)
+			result[b] = saturatingAdd(result[b], power[a * size + b]);
+	}
+	return result;
+}
+
+unsigned long long GrowthModel::length(const unsigned int numberOfIterations) const {
+	unsigned long long total = 0;
+	for (const unsigned long long &count : counts(numberOfIterations))
+		total = saturatingAdd(total, count);
+	return total;
+}
+
+GrowthPrediction GrowthModel::predict(const unsigned int numberOfIterations, const string &drawing_variables) const {
+	const vector<unsigned long long> alphabetCounts = counts(numberOfIterations);
+	GrowthPrediction prediction;
+	prediction.length = 0;
+	prediction.drawing_symbols = 0;
+	prediction.symbol_counts.fill(0);
+	for (size_t a = 0; a < _alphabet.size(); a++) {
+		const char symbol = _alphabet[a];
+		prediction.symbol_counts[(unsigned char)symbol] = alphabetCounts[a];
+		prediction.length = saturatingAdd(prediction.length, alphabetCounts[a]);
+		if (drawing_variables.find(symbol) != string::npos)
+			prediction.drawing_symbols = saturatingAdd(prediction.drawing_symbols, alphabetCounts[a]);
+	}
+	prediction.max_depth = maxDepth(numberOfIterations);
+	return prediction;
+}
@@ -0,0 +1,161 @@
+#ifndef DERIVATION_H
+#define DERIVATION_H
+
+#include <string>
+#include <vector>
+#include <iterator>
+#include <array>
+#include <unordered_map>
+#include <ostream>
+#include "rulematcher.h"
+
+/*Lazy derivation*/
+//produces the symbols of the n-th generation one at a time walking the rule tree depth first,
+//the generation itself is never stored: the stack holds one frame per level, so memory is
+//O(n * longest expansion) no matter how long the derived string is.
+//requires a context free rule set, every symbol must be rewritable on its own
+class SymbolStream {
+private:
+	struct Frame {
+		const char *symbols; //axiom or expansion being walked
+		size_t size, index;
+		unsigned int remaining; //iterations still to apply to the symbols of this frame
+	};
+	const RuleMatcher *_matcher;
+	std::string _axiom;
+	std::vector<Frame> _stack;
+public:
+	SymbolStream(const std::string &axiom, const RuleMatcher &matcher, const unsigned int numberOfIterations);
+	SymbolStream(const SymbolStream &) = delete; //the root frame points inside _axiom
+	SymbolStream &operator=(const SymbolStream &) = delete;
+
+	//writes the next symbol of the generation, false once the generation is over
+	bool next(char &symbol) {
+		while (!_stack.empty()) {
+			Frame &top = _stack.back();
+			if (top.index == top.size) {
+				_stack.pop_back();
+				continue;
+			}
+			const char current = top.symbols[top.index++];
+			if (top.remaining > 0) {
+				const std::string *expansion = _matcher->expansion((unsigned char)current);
+				if (expansion != nullptr) {
+					_stack.push_back({ expansion->data(), expansion->size(), 0, top.remaining - 1 });
+					continue;
+				}
+			}
+			symbol = current;
+			return true;
+		}
+		return false;
+	}
+
+	//single pass input iterator, lets the stream be used in range based for loops
+	class iterator {
+	private:
+		SymbolStream *_stream;
+		char _current;
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef char value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const char *pointer;
+		typedef const char &reference;
+
+		iterator(SymbolStream *stream) : _stream(stream), _current(0) { ++*this; }
+		reference operator*() const { return _current; }
+		iterator &operator++() {
+			if (_stream != nullptr && !_stream->next(_current))
+				_stream = nullptr;
+			return *this;
+		}
+		bool operator==(const iterator &other) const { return _stream == other._stream; }
+		bool operator!=(const iterator &other) const { return _stream != other._stream; }
+	};
+	iterator begin() { return iterator(this); }
+	iterator end() { return iterator(nullptr); }
+};
+
+/*Derivation DAG*/
+//with context free rules the expansion of a symbol after k iterations is the same wherever it appears,
+//so each (symbol, remaining iterations) pair is expanded once and shared by every occurrence.
+//the generation is the concatenation of the leaves under the root, the graph has at most
+//alphabet * n nodes no matter how long the generation is
+class DerivationDag {
+private:
+	struct Node {
+		bool leaf; //a single symbol of the generation
+		char symbol; //meaningful only for leaves
+		unsigned long long length; //symbols under the node, saturates at UINT64_MAX
+		unsigned int first_child, child_count; //range in _children, empty for leaves
+	};
+	const RuleMatcher *_matcher;
+	std::vector<Node> _nodes;
+	std::vector<unsigned int> _children;
+	std::unordered_map<unsigned long long, unsigned int> _interned; //(depth, symbol) -> node
+	unsigned int _root;
+
+	unsigned int intern(const char symbol, unsigned int depth);
+	unsigned int addNode(const bool leaf, const char symbol, const std::vector<unsigned int> &children);
+public:
+	DerivationDag(const std::string &axiom, const RuleMatcher &matcher, const unsigned int numberOfIterations);
+
+	unsigned long long length() const { return _nodes[_root].length; }
+	size_t nodeCount() const { return _nodes.size(); }
+	//random access to the generation, walks down a single path of the graph
+	char symbolAt(unsigned long long index) const;
+	//streams the generation to a file or any other stream in fixed size blocks
+	void write(std::ostream &stream) const;
+
+	//calls visitor(symbol) for every symbol of the generation in order, without flattening it
+	template<class Visitor> void traverse(Visitor &&visitor) const {
+		std::vector<std::pair<unsigned int, unsigned int>> stack; //node, next child
+		stack.push_back(std::make_pair(_root, 0u));
+		while (!stack.empty()) {
+			std::pair<unsigned int, unsigned int> &top = stack.back();
+			const Node &node = _nodes[top.first];
+			if (top.second == node.child_count) {
+				stack.pop_back();
+				continue;
+			}
+			const unsigned int child = _children[node.first_child + top.second++];
+			if (_nodes[child].leaf)
+				visitor(_nodes[child].symbol);
+			else
+				stack.push_back(std::make_pair(child, 0u));
+		}
+	}
+};
+
+/*Growth prediction*/
+//every count saturates at UINT64_MAX instead of wrapping around
+struct GrowthPrediction {
+	unsigned long long length; //symbols in the generation
+	std::array<unsigned long long, 256> symbol_counts; //occurrences of every symbol
+	unsigned long long drawing_symbols; //each one becomes a segment, two vertices
+	unsigned long long max_depth; //deepest bracket nesting reached
+};
+
+//Parikh vectors of the generations of a context free rule set: row a of the growth matrix counts the
+//symbols in the expansion of a, so the counts after n iterations are axiom * M^n, computed by repeated
+//squaring. the bracket depth is not linear in the counts and is folded over the rules once per iteration
+class GrowthModel {
+private:
+	const RuleMatcher *_matcher;
+	std::string _axiom;
+	std::string _alphabet; //symbols of the axiom and of the rules, in order of first appearance
+	std::array<int, 256> _index; //symbol -> position in _alphabet, -1 if absent
+	std::vector<unsigned long long> _matrix; //_alphabet.size() squared, row major
+
+	void addSymbol(const char symbol);
+	std::vector<unsigned long long> multiply(const std::vector<unsigned long long> &a, const std::vector<unsigned long long> &b) const;
+	std::vector<unsigned long long> counts(const unsigned int numberOfIterations) const; //indexed like _alphabet
+	unsigned long long maxDepth(const unsigned int numberOfIterations) const;
+public:
+	GrowthModel(const std::string &axiom, const RuleMatcher &matcher);
+	unsigned long long length(const unsigned int numberOfIterations) const;
+	GrowthPrediction predict(const unsigned int numberOfIterations, const std::string &drawing_variables) const;
+};
+
+#endif // !DERIVATION_H
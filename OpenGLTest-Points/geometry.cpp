@@ -0,0 +1,249 @@
+#include "geometry.h"
+#include <fstream>
+#include <cstring>
+using namespace std;
+
+constexpr char GEOMETRY_MAGIC[4] = { 'L', 'S', 'Y', 'S' };
+constexpr uint32_t GEOMETRY_VERSION = 1;
+constexpr uint32_t EMPTY_SLOT = ~0u;
+
+static uint64_t mix(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+static uint64_t hashVertex(const array<float, 3> &vertex) {
+	uint32_t bits[3];
+	memcpy(bits, vertex.data(), sizeof(bits));
+	return mix(((uint64_t)bits[0] << 32 | bits[1]) ^ mix(bits[2]));
+}
+
+/*Welding*/
+
+//open addressing tables with linear probing, grown to keep them at most half full
+bool weldLines(const vector<array<float, 3>> &segments, Geometry *geometry) {
+	geometry->vertices.clear();
+	geometry->lines.clear();
+	geometry->strips.clear();
+	//sized for a quarter of the endpoints and segments being distinct, grown beyond that
+	size_t capacity = 1024;
+	while (capacity < segments.size() / 2)
+		capacity <<= 1;
+	vector<uint32_t> vertexSlots(capacity, EMPTY_SLOT); //vertex index
+	vector<uint64_t> edgeSlots(capacity, ~0ull); //smaller index << 32 | larger index
+	size_t edges = 0;
+
+	auto findVertex = [&](const array<float, 3> &vertex) -> size_t {
+		size_t slot = hashVertex(vertex) & (vertexSlots.size() - 1);
+		while (vertexSlots[slot] != EMPTY_SLOT && memcmp(geometry->vertices[vertexSlots[slot]].data(), vertex.data(), sizeof(vertex)) != 0)
+			slot = (slot + 1) & (vertexSlots.size() - 1);
+		return slot;
+	};
+	auto findEdge = [&](const uint64_t edge) -> size_t {
+		size_t slot = mix(edge) & (edgeSlots.size() - 1);
+		while (edgeSlots[slot] != ~0ull && edgeSlots[slot] != edge)
+			slot = (slot + 1) & (edgeSlots.size() - 1);
+		return slot;
+	};
+
+	uint32_t previous = EMPTY_SLOT; //end of the last segment, usually where the next one starts
+	for (size_t i = 0; i + 1 < segments.size(); i += 2) {
+		uint32_t ends[2];
+		for (unsigned int j = 0; j < 2; j++) {
+			if (j == 0 && previous != EMPTY_SLOT && memcmp(segments[i].data(), segments[i - 1].data(), sizeof(segments[i])) == 0) {
+				ends[0] = previous;
+				continue;
+			}
+			array<float, 3> vertex = segments[i + j];
+			for (float &coordinate : vertex)
+				coordinate = coordinate == 0.0f ? 0.0f : coordinate; //-0 and 0 are the same point
+			size_t slot = findVertex(vertex);
+			if (vertexSlots[slot] == EMPTY_SLOT) {
+				if (geometry->vertices.size() == EMPTY_SLOT) {
+					geometry->vertices.clear();
+					geometry->lines.clear();
+					return false;
+				}
+				vertexSlots[slot] = (uint32_t)geometry->vertices.size();
+				geometry->vertices.push_back(vertex);
+				if (geometry->vertices.size() * 2 > vertexSlots.size()) {
+					vertexSlots.assign(vertexSlots.size() * 2, EMPTY_SLOT);
+					for (uint32_t index = 0; index < geometry->vertices.size(); index++)
+						vertexSlots[findVertex(geometry->vertices[index])] = index;
+					slot = findVertex(vertex);
+				}
+			}
+			ends[j] = vertexSlots[slot];
+		}
+		previous = ends[1];
+		if (ends[0] == ends[1])
+			continue;
+		const uint64_t edge = ends[0] < ends[1] ? (uint64_t)ends[0] << 32 | ends[1] : (uint64_t)ends[1] << 32 | ends[0];
+		const size_t slot = findEdge(edge);
+		if (edgeSlots[slot] == edge)
+			continue;
+		edgeSlots[slot] = edge;
+		geometry->lines.push_back(ends[0]);
+		geometry->lines.push_back(ends[1]);
+		if (++edges * 2 > edgeSlots.size()) {
+			vector<uint64_t> old(edgeSlots.size() * 2, ~0ull);
+			old.swap(edgeSlots);
+			for (const uint64_t &stored : old) {
+				if (stored != ~0ull)
+					edgeSlots[findEdge(stored)] = stored;
+			}
+		}
+	}
+	return true;
+}
+
+bool stripLines(Geometry *geometry) {
+	//n segments in k strips take n + 2k - 1 indices, and n + k vertices when the geometry is plain
+	const bool indexed = !geometry->lines.empty();
+	const size_t segments = indexed ? geometry->lines.size() / 2 : geometry->vertices.size() / 2;
+	size_t strips = 0;
+	for (size_t i = 0; i < segments; i++) {
+		if (i == 0 || (indexed ? geometry->lines[2 * i] != geometry->lines[2 * i - 1] :
+			memcmp(geometry->vertices[2 * i].data(), geometry->vertices[2 * i - 1].data(), sizeof(array<float, 3>)) != 0))
+			strips++;
+	}
+	const size_t stripBytes = (segments + 2 * strips) * sizeof(uint32_t) + (indexed ? 0 : (segments + strips) * sizeof(array<float, 3>));
+	const size_t segmentBytes = indexed ? geometry->lines.size() * sizeof(uint32_t) : geometry->vertices.size() * sizeof(array<float, 3>);
+	if (segments == 0 || stripBytes >= segmentBytes || (!indexed && segments + strips >= STRIP_RESTART))
+		return false;
+
+	vector<uint32_t> indices;
+	indices.reserve(segments + 2 * strips);
+	if (indexed) {
+		for (size_t i = 0; i + 1 < geometry->lines.size(); i += 2) {
+			if (indices.empty() || indices.back() != geometry->lines[i]) {
+				if (!indices.empty())
+					indices.push_back(STRIP_RESTART);
+				indices.push_back(geometry->lines[i]);
+			}
+			indices.push_back(geometry->lines[i + 1]);
+		}
+		geometry->lines.clear();
+		geometry->strips.swap(indices);
+		return true;
+	}
+	//plain geometry, the joined vertices are stored once
+	const vector<array<float, 3>> &pairs = geometry->vertices;
+	vector<array<float, 3>> vertices;
+	vertices.reserve(segments + strips);
+	for (size_t i = 0; i + 1 < pairs.size(); i += 2) {
+		if (vertices.empty() || memcmp(vertices.back().data(), pairs[i].data(), sizeof(pairs[i])) != 0) {
+			if (!vertices.empty())
+				indices.push_back(STRIP_RESTART);
+			indices.push_back((uint32_t)vertices.size());
+			vertices.push_back(pairs[i]);
+		}
+		indices.push_back((uint32_t)vertices.size());
+		vertices.push_back(pairs[i + 1]);
+	}
+	geometry->vertices.swap(vertices);
+	geometry->strips.swap(indices);
+	return true;
+}
+
+/*Files*/
+
+static void writeSection(ostream &stream, const uint32_t type, const void *data, const uint64_t bytes) {
+	stream.write((const char*)&type, sizeof(type));
+	stream.write((const char*)&bytes, sizeof(bytes));
+	stream.write((const char*)data, (streamsize)bytes);
+}
+
+bool writeGeometry(ostream &stream, const Geometry &geometry) {
+	const uint32_t sections = 1 + (geometry.lines.empty() ? 0 : 1) + (geometry.strips.empty() ? 0 : 1) +
+		(geometry.tubes.empty() ? 0 : 1) + (geometry.triangles.empty() ? 0 : 1) + (geometry.attributes.empty() ? 0 : 1);
+	stream.write(GEOMETRY_MAGIC, sizeof(GEOMETRY_MAGIC));
+	stream.write((const char*)&GEOMETRY_VERSION, sizeof(GEOMETRY_VERSION));
+	stream.write((const char*)&sections, sizeof(sections));
+	writeSection(stream, SECTION_VERTICES, geometry.vertices.data(), geometry.vertices.size() * sizeof(array<float, 3>));
+	if (!geometry.lines.empty())
+		writeSection(stream, SECTION_LINES, geometry.lines.data(), geometry.lines.size() * sizeof(uint32_t));
+	if (!geometry.strips.empty())
+		writeSection(stream, SECTION_STRIPS, geometry.strips.data(), geometry.strips.size() * sizeof(uint32_t));
+	if (!geometry.tubes.empty())
+		writeSection(stream, SECTION_TUBES, geometry.tubes.data(), geometry.tubes.size() * sizeof(TubeInstance));
+	if (!geometry.triangles.empty())
+		writeSection(stream, SECTION_TRIANGLES, geometry.triangles.data(), geometry.triangles.size() * sizeof(array<float, 3>));
+	if (!geometry.attributes.empty())
+		writeSection(stream, SECTION_ATTRIBUTES, geometry.attributes.data(), geometry.attributes.size() * sizeof(VertexAttributes));
+	return stream.good();
+}
+
+bool readGeometry(const string &filename, Geometry *geometry) {
+	geometry->vertices.clear();
+	geometry->lines.clear();
+	geometry->strips.clear();
+	geometry->tubes.clear();
+	geometry->triangles.clear();
+	geometry->attributes.clear();
+	ifstream file(filename, ios::in | ios::binary | ios::ate);
+	if (!file.is_open())
+		return false;
+	const uint64_t size = (uint64_t)file.tellg();
+	file.seekg(0, ios::beg);
+	char magic[4] = {};
+	uint32_t version = 0, sections = 0;
+	if (size >= sizeof(magic) + 2 * sizeof(uint32_t))
+		file.read(magic, sizeof(magic));
+	if (memcmp(magic, GEOMETRY_MAGIC, sizeof(magic)) != 0) { //plain vertices
+		file.seekg(0, ios::beg);
+		geometry->vertices.resize((size_t)(size / sizeof(array<float, 3>)));
+		file.read((char*)geometry->vertices.data(), geometry->vertices.size() * sizeof(array<float, 3>));
+		return !file.fail();
+	}
+	file.read((char*)&version, sizeof(version));
+	file.read((char*)&sections, sizeof(sections));
+	if (version != GEOMETRY_VERSION)
+		return false;
+	for (uint32_t i = 0; i < sections && file.good(); i++) {
+		uint32_t type = 0;
+		uint64_t bytes = 0;
+		file.read((char*)&type, sizeof(type));
+		file.read((char*)&bytes, sizeof(bytes));
+		if (file.fail() || bytes > size)
+			return false;
+		//sections of whole elements only
+		auto readSection = [&](auto &section) {
+			const size_t element = sizeof(section[0]);
+			section.resize((size_t)(bytes / element));
+			file.read((char*)section.data(), section.size() * element);
+			return bytes % element == 0;
+		};
+		bool whole = true;
+		if (type == SECTION_VERTICES)
+			whole = readSection(geometry->vertices);
+		else if (type == SECTION_LINES)
+			whole = readSection(geometry->lines);
+		else if (type == SECTION_STRIPS)
+			whole = readSection(geometry->strips);
+		else if (type == SECTION_TUBES)
+			whole = readSection(geometry->tubes);
+		else if (type == SECTION_TRIANGLES)
+			whole = readSection(geometry->triangles);
+		else if (type == SECTION_ATTRIBUTES)
+			whole = readSection(geometry->attributes);
+		else
+			file.seekg((streamoff)bytes, ios::cur);
+		if (!whole)
+			return false;
+	}
+	if (file.fail() || (!geometry->attributes.empty() && geometry->attributes.size() != geometry->vertices.size()))
+		return false;
+	for (const uint32_t &index : geometry->lines) {
+		if (index >= geometry->vertices.size())
+			return false;
+	}
+	for (const uint32_t &index : geometry->strips) {
+		if (index != STRIP_RESTART && index >= geometry->vertices.size())
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,76 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <iostream>
+
+/*Indexed line geometry*/
+//vertices drawn as GL_LINES through lines, two indices per segment, or as GL_LINE_STRIP through strips,
+//where STRIP_RESTART starts a new strip. both are empty for plain geometry, where every two consecutive
+//vertices are a segment
+constexpr uint32_t STRIP_RESTART = ~0u;
+
+//a segment drawn as an instance of a shared cylinder stretched from start to end (see tubes.h)
+struct TubeInstance {
+	std::array<float, 3> start, end;
+	float radius;
+};
+
+//attributes the turtle can give every vertex, combined as flags
+enum VertexAttribute : unsigned int {
+	ATTRIBUTE_DEPTH = 1, //bracket depth of the segment
+	ATTRIBUTE_WIDTH = 2, //width set by !
+	ATTRIBUTE_COLOR = 4, //color index set by '
+	ATTRIBUTE_ALL = 7,
+};
+
+//the attributes of a vertex interleaved in 4 bytes. depth and color are bytes read as normalized values, the
+//depth clamped to 255, the width is a half float. attributes that were not generated are 0
+struct VertexAttributes {
+	uint8_t depth;
+	uint8_t color;
+	uint16_t width;
+};
+
+struct Geometry {
+	std::vector<std::array<float, 3>> vertices;
+	std::vector<uint32_t> lines;
+	std::vector<uint32_t> strips;
+	std::vector<TubeInstance> tubes; //the segments as tubes, drawn instead of the lines
+	std::vector<std::array<float, 3>> triangles; //3 vertices per triangle, drawn with the lines or tubes
+	std::vector<VertexAttributes> attributes; //one for every vertex of plain geometry, or none
+
+	bool isIndexed() const { return !lines.empty() || !strips.empty(); }
+	//only vertices, written without the header
+	bool isPlain() const { return !isIndexed() && tubes.empty() && triangles.empty() && attributes.empty(); }
+};
+
+//welds the bitwise identical endpoints of the segments (pairs of consecutive vertices) and removes the segments
+//drawn more than once in either direction and those of zero length. false, leaving geometry empty, if there
+//would be more vertices than 32 bit indices can address
+bool weldLines(const std::vector<std::array<float, 3>> &segments, Geometry *geometry);
+//joins every segment starting where the previous one ends into strips: the lines of indexed geometry, the pairs
+//of vertices of plain geometry, whose joined ends are then dropped. false, leaving geometry unchanged, if the
+//strips would not be smaller, as with short branches, or need more vertices than 32 bit indices can address
+bool stripLines(Geometry *geometry);
+
+/*Geometry files*/
+//"LSYS", a version and a section count, then the sections: a type, the byte size of the data and the data.
+//files without the header are read as plain vertices, the format written before it existed
+enum GeometrySection : uint32_t {
+	SECTION_VERTICES = 1, //3 floats per vertex
+	SECTION_LINES = 2, //32 bit indices, 2 per segment
+	SECTION_STRIPS = 3, //32 bit indices, STRIP_RESTART between strips
+	SECTION_TUBES = 4, //start, end and radius of every tube, 7 floats
+	SECTION_TRIANGLES = 5, //3 floats per vertex, 3 vertices per triangle
+	SECTION_ATTRIBUTES = 6, //VertexAttributes of every vertex, 4 bytes
+};
+
+bool writeGeometry(std::ostream &stream, const Geometry &geometry);
+//false if the file can't be opened or is malformed. unknown sections are skipped
+bool readGeometry(const std::string &filename, Geometry *geometry);
+
+#endif // !GEOMETRY_H
@@ -1,115 +1,642 @@
 #include "lsystem.h"
+#include "derivation.h"
+#include "turtle.h"
+#include "ringbuffer.h"
+#include "geometry.h"
+#include "tubes.h"
+#include "polygons.h"
 #include <fstream>
 #include <iostream>
 #include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstring>
+#include <thread>
+#include <climits>
+#include <stdexcept>
+#include <type_traits>
+#include <chrono>
 using namespace std;
 
 /*LSystem*/
 
+//whether symbols has one of modules, parameters in parentheses are skipped
+static bool hasModules(const string &symbols, const char *modules) {
+	unsigned int depth = 0;
+	for (const char &symbol : symbols) {
+		if (symbol == '(')
+			depth++;
+		else if (symbol == ')' && depth > 0)
+			depth--;
+		else if (depth == 0 && symbol != '\0' && strchr(modules, symbol) != nullptr)
+			return true;
+	}
+	return false;
+}
+
 LSystem::LSystem() {
 	//make the custom requests
 	_status = "0", _drawing_variables = "0";
 	_rules = { {"0", "0[0]0"} };
+	_matcher.compile(_rules, _stochastic_rules);
 	_turning_angle = 3.1415f / 4.0f;
 	_starting_angle = 0.0f;
+	_thread_count = max(1u, thread::hardware_concurrency());
+	_derivation_strategy = DERIVE_EAGER;
+	_pending_iterations = 0;
+	_generation = 0;
+	_merge_collinear = false;
+	detectTurtleModes();
 }
 
 LSystem::LSystem(const string *status, const vector<pair<string, string>> *rules, const string *drawing_variables, const float turning_angle) {
 	_status = *status;
 	_rules = *rules;
+	_matcher.compile(_rules, _stochastic_rules);
 	_drawing_variables = *drawing_variables;
 	_turning_angle = turning_angle;
 	_starting_angle = 0.0f;
+	_thread_count = max(1u, thread::hardware_concurrency());
+	_derivation_strategy = DERIVE_EAGER;
+	_pending_iterations = 0;
+	_generation = 0;
+	_merge_collinear = false;
+	detectTurtleModes();
 }
 
 LSystem::LSystem(const char *status, const std::vector<std::pair<std::string, std::string>> rules, const char *drawing_variables, const float turning_angle) {
 	_status = status;
 	_rules = rules;
+	_matcher.compile(_rules, _stochastic_rules);
 	_drawing_variables = drawing_variables;
 	_turning_angle = turning_angle;
 	_starting_angle = 0.0f;
+	_thread_count = max(1u, thread::hardware_concurrency());
+	_derivation_strategy = DERIVE_EAGER;
+	_pending_iterations = 0;
+	_generation = 0;
+	_merge_collinear = false;
+	detectTurtleModes();
 }
 
 
-string LSystem::getStatus() { return _status; }
+string LSystem::getStatus() {
+	applyPendingIterations();
+	return _status;
+}
+
+unsigned long long LSystem::getStatusLength() {
+	if (_modules)
+		return _modules->symbols.size();
+	if (_dag)
+		return _dag->length();
+	if (_packed)
+		return _packed->size();
+	if (_runs)
+		return _runs->length();
+	if (_pending_iterations > 0)
+		return GrowthModel(_status, _matcher).length(_pending_iterations);
+	return _status.size();
+}
+
+void LSystem::writeStatus(ostream &stream) {
+	if (_modules) {
+		const string text = _modules->format();
+		stream.write(text.data(), text.size());
+	}
+	else if (_dag)
+		_dag->write(stream);
+	else if (_packed) {
+		string block;
+		_packed->forEach([&](const unsigned int code) {
+			block.push_back(_alphabet->symbol(code));
+			if (block.size() == 1 << 16) {
+				stream.write(block.data(), block.size());
+				block.clear();
+			}
+		});
+		stream.write(block.data(), block.size());
+	}
+	else if (_runs) {
+		for (const SymbolRun &run : _runs->runs()) {
+			const string block((size_t)min(run.count, 1ull << 16), run.symbol);
+			for (unsigned long long written = 0; written < run.count; written += block.size())
+				stream.write(block.data(), (streamsize)min((unsigned long long)block.size(), run.count - written));
+		}
+	}
+	else if (_pending_iterations > 0) {
+		DerivationDag dag(_status, _matcher, _pending_iterations);
+		dag.write(stream);
+	}
+	else
+		stream.write(_status.data(), _status.size());
+}
 vector<rule> LSystem::getRules() { return _rules; }
+vector<StochasticRule> LSystem::getStochasticRules() { return _stochastic_rules; }
+vector<string> LSystem::getParametricRules() { return _parametric_rules; }
 float LSystem::getStartingAngle() { return _starting_angle; }
 
-void LSystem::setStatus(const string *status) { _status = *status; }
-void LSystem::setRules(const vector<rule> *rules) { _rules = *rules; }
+void LSystem::setStatus(const string *status) {
+	_status = *status;
+	_pending_iterations = 0;
+	_generation = 0;
+	_dag.reset();
+	_packed.reset();
+	_runs.reset();
+	_modules.reset();
+	_program.reset();
+	detectTurtleModes();
+}
+void LSystem::setRules(const vector<rule> *rules) {
+	applyPendingIterations();
+	_rules = *rules;
+	_matcher.compile(_rules, _stochastic_rules);
+	for (const rule &plain : _rules)
+		noteTurtleModes(plain.second);
+}
 void LSystem::setStartingAngle(const float starting_angle) { _starting_angle = starting_angle; }
-void LSystem::setDrawingVariables(const std::string *drawing_variables) { _drawing_variables = *drawing_variables; }
+void LSystem::setDrawingVariables(const std::string *drawing_variables) {
+	_drawing_variables = *drawing_variables;
+	_program.reset();
+}
 void LSystem::setTurningAngle(const float turning_angle) { _turning_angle = turning_angle; }
 
-void LSystem::addRule(const std::string *condition, const std::string *expansion) {
-	_rules.push_back(make_pair(*condition, *expansion));
+void LSystem::setThreadCount(const unsigned int thread_count) {
+	_thread_count = max(1u, thread_count);
+	_pool.reset();
 }
 
-bool compareRulesInstances(const pair<string, unsigned int> &a, const pair<string, unsigned int> &b) {
-	return a.second < b.second;
+void LSystem::setMergeCollinear(const bool merge) { _merge_collinear = merge; }
+
+//every generation is made of symbols of the axiom and of the expansions. rules changed after deriving
+//only add to what the status may hold
+void LSystem::detectTurtleModes() {
+	_three_dimensional = false;
+	_polygons = false;
+	noteTurtleModes(_status);
+	for (const rule &plain : _rules)
+		noteTurtleModes(plain.second);
+	for (const StochasticRule &stochastic : _stochastic_rules) {
+		for (const pair<string, float> &expansion : stochastic.expansions)
+			noteTurtleModes(expansion.first);
+	}
+	for (const string &text : _parametric_rules)
+		noteTurtleModes(text.substr(text.find("->") + 2));
 }
 
-vector<pair<string, unsigned int>> LSystem::getRulesInstances(){
-	vector<pair<string, unsigned int>> rulesInstances;
-	for (const rule &rule : _rules) {
-		string condition = rule.first;
-		size_t foundSubStringIndex = _status.find(condition);
-		while (foundSubStringIndex != string::npos) {
-			rulesInstances.push_back(make_pair(rule.second, foundSubStringIndex));
-			foundSubStringIndex = _status.find(condition, foundSubStringIndex + 1);
-		}
+void LSystem::noteTurtleModes(const string &symbols) {
+	_three_dimensional = _three_dimensional || hasModules(symbols, "&^\\/|");
+	_polygons = _polygons || hasModules(symbols, "{");
+}
+
+template<unsigned int ATTRIBUTES> BasicTurtle<ATTRIBUTES> LSystem::createTurtle(vector<array<float, 3>> *vertices) const {
+	BasicTurtle<ATTRIBUTES> turtle(_drawing_variables, _starting_angle, _turning_angle, vertices);
+	turtle.setMergeCollinear(_merge_collinear);
+	turtle.setThreeDimensional(_three_dimensional);
+	return turtle;
+}
+
+//calls interpret(set) with set an integral_constant of attributes, so it can create the turtle specialized on them
+template<class Interpret> static void withAttributeSet(const unsigned int attributes, Interpret &&interpret) {
+	switch (attributes & ATTRIBUTE_ALL) {
+	case 0: interpret(integral_constant<unsigned int, 0>()); break;
+	case 1: interpret(integral_constant<unsigned int, 1>()); break;
+	case 2: interpret(integral_constant<unsigned int, 2>()); break;
+	case 3: interpret(integral_constant<unsigned int, 3>()); break;
+	case 4: interpret(integral_constant<unsigned int, 4>()); break;
+	case 5: interpret(integral_constant<unsigned int, 5>()); break;
+	case 6: interpret(integral_constant<unsigned int, 6>()); break;
+	default: interpret(integral_constant<unsigned int, 7>()); break;
 	}
-	sort(rulesInstances.rbegin(), rulesInstances.rend(), compareRulesInstances);
-	
-	return rulesInstances;
 }
 
-void LSystem::doIterations(const unsigned int numberOfIterations) {
+void LSystem::setDerivationStrategy(const DerivationStrategy strategy) {
+	applyPendingIterations();
+	_derivation_strategy = strategy;
+}
+
+//materializes the generations deferred by the lazy, dag, packed and rle strategies and by parametric rules
+void LSystem::applyPendingIterations() {
+	if (_pending_iterations == 0)
+		return;
+	string derived;
+	if (_modules)
+		derived = _modules->format();
+	else if (_dag) {
+		derived.reserve((size_t)_dag->length());
+		_dag->traverse([&](const char symbol) { derived.push_back(symbol); });
+	}
+	else if (_packed) {
+		derived.reserve(_packed->size());
+		_packed->forEach([&](const unsigned int code) { derived.push_back(_alphabet->symbol(code)); });
+	}
+	else if (_runs) {
+		derived.reserve((size_t)_runs->length());
+		for (const SymbolRun &run : _runs->runs())
+			derived.append((size_t)run.count, run.symbol);
+	}
+	else {
+		SymbolStream stream(_status, _matcher, _pending_iterations);
+		for (const char &symbol : stream)
+			derived.push_back(symbol);
+	}
+	_status.swap(derived);
+	_generation += _pending_iterations;
+	_pending_iterations = 0;
+	_dag.reset();
+	_packed.reset();
+	_runs.reset();
+	_modules.reset();
+}
+
+//the packed generation replaces the status until it is read back, rewriting never unpacks it
+void LSystem::derivePacked(const unsigned int numberOfIterations) {
+	if (!_packed) {
+		_alphabet.reset(new SymbolAlphabet(_status, _matcher));
+		_packed.reset(new PackedString(_alphabet->bitsPerSymbol()));
+		_packed->reserve(_status.size());
+		for (const char &symbol : _status)
+			_packed->push_back(_alphabet->code(symbol));
+	}
+	GrowthModel growth(_status, _matcher);
+	PackedRules rules(*_alphabet, _matcher);
+	PackedString next(_alphabet->bitsPerSymbol());
+	for (unsigned int i = 0; i < numberOfIterations; i++) {
+		next.clear();
+		const unsigned long long length = growth.length(_pending_iterations + 1);
+		if (length < SIZE_MAX)
+			next.reserve((size_t)length);
+		rules.rewrite(*_packed, next);
+		_packed->swap(next);
+		_pending_iterations++;
+	}
+}
+
+//the run length generation replaces the status until it is read back
+void LSystem::deriveRuns(const unsigned int numberOfIterations) {
+	if (!_runs)
+		_runs.reset(new RunString(_status));
+	RunRules rules(_matcher);
+	RunString next;
+	for (unsigned int i = 0; i < numberOfIterations; i++) {
+		next.clear();
+		rules.rewrite(*_runs, next);
+		_runs->swap(next);
+		_pending_iterations++;
+	}
+}
+
+//parametric generations are kept as modules until they are read back
+void LSystem::deriveParametric(const unsigned int numberOfIterations) {
+	const ParametricRules rules = compileParametricRules();
+	prepareModules();
+	if (_thread_count > 1 && !_pool)
+		_pool.reset(new ThreadPool(_thread_count));
+	ParametricString next;
 	for (unsigned int i = 0; i < numberOfIterations; i++) {
-		vector<pair<string, unsigned int>> rulesInstances = getRulesInstances();
+		next.clear();
+		rules.rewrite(*_modules, next, _pool.get());
+		_modules->swap(next);
+		_pending_iterations++;
+	}
+}
+
+ParametricRules LSystem::compileParametricRules() const {
+	ParametricRules rules;
+	for (const rule &plain : _rules)
+		rules.addPlainRule(plain.first, plain.second);
+	for (const string &text : _parametric_rules)
+		rules.addRule(text);
+	return rules;
+}
+
+//the status as modules, parsed the first time it is needed
+void LSystem::prepareModules() {
+	if (_modules)
+		return;
+	_modules.reset(new ParametricString());
+	if (!parseModules(_status, _modules.get())) { //malformed parameters, read as symbols
+		_modules->symbols = _status;
+		_modules->arities.assign(_status.size(), 0);
+	}
+}
+
+bool LSystem::addParametricRule(const std::string *rule) {
+	ParametricRules check;
+	if (!check.addRule(*rule))
+		return false;
+	applyPendingIterations();
+	_parametric_rules.push_back(*rule);
+	noteTurtleModes(rule->substr(rule->find("->") + 2));
+	return true;
+}
+
+void LSystem::addRule(const std::string *condition, const std::string *expansion) {
+	applyPendingIterations();
+	_rules.push_back(make_pair(*condition, *expansion));
+	noteTurtleModes(*expansion);
+	_matcher.compile(_rules, _stochastic_rules);
+}
+
+void LSystem::addStochasticRule(const std::string *condition, const std::string *expansion, const float weight) {
+	applyPendingIterations();
+	auto existing = find_if(_stochastic_rules.begin(), _stochastic_rules.end(), [&](const StochasticRule &rule) { return rule.condition == *condition; });
+	if (existing == _stochastic_rules.end()) {
+		_stochastic_rules.push_back(StochasticRule());
+		existing = _stochastic_rules.end() - 1;
+		existing->condition = *condition;
+	}
+	existing->expansions.push_back(make_pair(*expansion, weight));
+	noteTurtleModes(*expansion);
+	_matcher.compile(_rules, _stochastic_rules);
+}
+
+void LSystem::setSeed(const unsigned long long seed) { _matcher.setSeed(seed); }
+void LSystem::setContextIgnored(const std::string *symbols) { applyPendingIterations(); _matcher.setContextIgnored(*symbols); }
+
+void LSystem::doIterations(const unsigned int numberOfIterations) {
+	_program.reset();
+	if (!_parametric_rules.empty()) {
+		deriveParametric(numberOfIterations);
+		return;
+	}
+	//the lazy strategy only records the iterations, they are derived while the status is read.
+	//the dag strategy also builds the graph of the deferred generation, which is cheap
+	if ((_derivation_strategy == DERIVE_LAZY || _derivation_strategy == DERIVE_DAG) && _matcher.hasFixedExpansions()) {
+		_pending_iterations += numberOfIterations;
+		if (_derivation_strategy == DERIVE_DAG)
+			_dag.reset(new DerivationDag(_status, _matcher, _pending_iterations));
+		return;
+	}
+	if (_derivation_strategy == DERIVE_PACKED && _matcher.hasFixedExpansions()) {
+		derivePacked(numberOfIterations);
+		return;
+	}
+	if (_derivation_strategy == DERIVE_RLE && _matcher.hasFixedExpansions()) {
+		deriveRuns(numberOfIterations);
+		return;
+	}
+	applyPendingIterations();
+
+	if (_thread_count > 1 && !_pool)
+		_pool.reset(new ThreadPool(_thread_count));
 
-		for (const pair<string, unsigned int> &ruleInstance : rulesInstances) {
-			_status.at(ruleInstance.second) = ruleInstance.first.at(0);
-			_status.insert(ruleInstance.second + 1, &ruleInstance.first.at(1));
+	//with fixed expansions every generation length is known in advance and the buffer is allocated once
+	unique_ptr<GrowthModel> growth;
+	if (_matcher.hasFixedExpansions())
+		growth.reset(new GrowthModel(_status, _matcher));
+
+	//the k-step strategy skips the intermediate generations: each pass applies the rules composed k times
+	unsigned int steps = 1;
+	RuleMatcher composed;
+	if (_derivation_strategy == DERIVE_KSTEP && _matcher.hasFixedExpansions()) {
+		steps = compositionSteps(numberOfIterations);
+		if (steps > 1)
+			composed = _matcher.power(steps);
+	}
+
+	//double buffering: the next generation is written in a separate string and then swapped,
+	//the old buffer keeps its capacity and is reused by the following pass
+	string next;
+	for (unsigned int done = 0; done < numberOfIterations;) {
+		const unsigned int passSteps = min(steps, numberOfIterations - done);
+		if (passSteps < steps) //last pass with the remaining iterations
+			composed = _matcher.power(passSteps);
+		done += passSteps;
+
+		next.clear();
+		if (growth) {
+			const unsigned long long length = growth->length(done);
+			if (length < next.max_size())
+				next.reserve((size_t)length);
 		}
+		(passSteps > 1 ? composed : _matcher).rewrite(_status, next, _generation, _pool.get());
+		_status.swap(next);
+		_generation += passSteps;
 	}
 }
 
-vector<array<float, 3>> * LSystem::translateStatus() {
-	vector<pair<array<float, 3>, float>> stack; //x,y,z, alpha angle
-	constexpr float M_PI = 3.14159265358979323846f;
+//largest k whose composed rules stay within the budget, their expansions are read for every symbol of a pass
+unsigned int LSystem::compositionSteps(const unsigned int numberOfIterations) const {
+	constexpr unsigned long long COMPOSED_RULES_BUDGET = 1 << 18; //symbols, all the k-step expansions together
+	string ruleSymbols;
+	for (unsigned int symbol = 0; symbol < 256; symbol++) {
+		if (_matcher.expansion((unsigned char)symbol) != nullptr)
+			ruleSymbols.push_back((char)symbol);
+	}
+	GrowthModel growth(ruleSymbols, _matcher);
+	unsigned int steps = 1;
+	while (steps < numberOfIterations && growth.length(steps + 1) <= COMPOSED_RULES_BUDGET)
+		steps++;
+	return steps;
+}
+
+bool LSystem::predictGrowth(const unsigned int numberOfIterations, GrowthPrediction *prediction) {
+	if (!_parametric_rules.empty() || !_matcher.hasFixedExpansions())
+		return false;
+	GrowthModel growth(_status, _matcher);
+	*prediction = growth.predict(_pending_iterations + numberOfIterations, _drawing_variables);
+	return true;
+}
+
+unsigned int LSystem::packedBitsPerSymbol() const {
+	return _alphabet ? _alphabet->bitsPerSymbol() : SymbolAlphabet(_status, _matcher).bitsPerSymbol();
+}
 
-	string status = getStatus();
+vector<array<float, 3>> * LSystem::translateStatus(const unsigned int attributeSet, vector<VertexAttributes> *attributes, vector<array<float, 3>> *triangles) {
 	vector<array<float, 3>> *vertexArray = new vector<array<float, 3>>;
-	array<float, 3> currentRootVertex = { 0.0f, 0.0f, 0.0f };
-	float alpha = _starting_angle; //current 
-	for (const char &current : status) {
-		//if is a drawing variable set new points
-		if (_drawing_variables.find(current) != string::npos){
-			vertexArray->push_back(currentRootVertex);
-			currentRootVertex = { currentRootVertex[0] + cosf(alpha), currentRootVertex[1] + sinf(alpha), 0.0f };
-			vertexArray->push_back(currentRootVertex);
-		}
-		else if (current == '[') { 
-			stack.push_back(make_pair(currentRootVertex, alpha));
+	//merged moves become single segments, the symbol count would only be an upper bound
+	GrowthPrediction prediction;
+	if (!_merge_collinear && predictGrowth(0, &prediction) && prediction.drawing_symbols < vertexArray->max_size() / 2) {
+		vertexArray->reserve((size_t)prediction.drawing_symbols * 2);
+		if (attributes != nullptr)
+			attributes->reserve((size_t)prediction.drawing_symbols * 2);
+	}
+	unique_ptr<Triangulator> triangulator(triangles != nullptr && _polygons ? new Triangulator(triangles) : nullptr);
+	withAttributeSet(attributes != nullptr ? attributeSet : 0, [&](auto set) {
+		auto turtle = createTurtle<decltype(set)::value>(vertexArray);
+		turtle.setAttributes(attributes);
+		turtle.setPolygons(triangulator.get());
+		if (_program)
+			_program->run(turtle);
+		else if (_modules) {
+			const float *parameters = _modules->parameters.data();
+			for (size_t i = 0; i < _modules->symbols.size(); i++) {
+				turtle.consume(_modules->symbols[i], parameters, _modules->arities[i]);
+				parameters += _modules->arities[i];
+			}
 		}
-		else if (current == ']') { 
-			currentRootVertex = stack.back().first;
-			alpha = stack.back().second;
-			stack.pop_back();
+		else if (_dag)
+			_dag->traverse([&](const char symbol) { turtle.consume(symbol); });
+		else if (_packed)
+			_packed->forEach([&](const unsigned int code) { turtle.consume(_alphabet->symbol(code)); });
+		else if (_runs) {
+			for (const SymbolRun &run : _runs->runs())
+				turtle.consumeRun(run.symbol, run.count);
 		}
-		else if (current == '+') { 
-			alpha += _turning_angle;
+		else if (_pending_iterations > 0) {
+			SymbolStream stream(_status, _matcher, _pending_iterations);
+			for (const char &current : stream)
+				turtle.consume(current);
 		}
-		else if (current == '-') { 
-			alpha -= _turning_angle;
+		else {
+			if (_thread_count > 1 && !_pool)
+				_pool.reset(new ThreadPool(_thread_count));
+			turtle.consumeAll(_status, _pool.get());
 		}
+	});
+	if (triangulator)
+		triangulator->finish();
+	return vertexArray;
+}
+
+bool LSystem::compileTurtleProgram() {
+	if (!_parametric_rules.empty())
+		return false;
+	unique_ptr<TurtleProgram> program(new TurtleProgram(_drawing_variables));
+	if (_dag)
+		_dag->traverse([&](const char symbol) { program->add(symbol); });
+	else if (_packed)
+		_packed->forEach([&](const unsigned int code) { program->add(_alphabet->symbol(code)); });
+	else if (_runs) {
+		for (const SymbolRun &run : _runs->runs())
+			program->addRun(run.symbol, run.count);
+	}
+	else if (_pending_iterations > 0) {
+		SymbolStream stream(_status, _matcher, _pending_iterations);
+		for (const char &current : stream)
+			program->add(current);
 	}
+	else {
+		for (const char &symbol : _status)
+			program->add(symbol);
+	}
+	program->finish();
+	_program = move(program);
+	return true;
+}
+
+//calls visitor(symbol, parameters, arity) for every module of the generation after the status
+template<class Visitor> void LSystem::visitNextGeneration(Visitor &&visitor) {
+	if (!_parametric_rules.empty()) {
+		prepareModules();
+		compileParametricRules().visit(*_modules, visitor);
+	}
+	else if (_pending_iterations > 0) {
+		//every deferred form keeps the axiom in the status, the next generation is streamed from it
+		SymbolStream stream(_status, _matcher, _pending_iterations + 1);
+		for (const char &current : stream)
+			visitor(current, nullptr, 0);
+	}
+	else
+		_matcher.visit(_status, _generation, [&](const char symbol) { visitor(symbol, nullptr, 0); });
+}
+
+vector<array<float, 3>> * LSystem::translateNextGeneration(const unsigned int attributeSet, vector<VertexAttributes> *attributes, vector<array<float, 3>> *triangles) {
+	vector<array<float, 3>> *vertexArray = new vector<array<float, 3>>;
+	GrowthPrediction prediction;
+	if (!_merge_collinear && predictGrowth(1, &prediction) && prediction.drawing_symbols < vertexArray->max_size() / 2) {
+		vertexArray->reserve((size_t)prediction.drawing_symbols * 2);
+		if (attributes != nullptr)
+			attributes->reserve((size_t)prediction.drawing_symbols * 2);
+	}
+	unique_ptr<Triangulator> triangulator(triangles != nullptr && _polygons ? new Triangulator(triangles) : nullptr);
+	withAttributeSet(attributes != nullptr ? attributeSet : 0, [&](auto set) {
+		auto turtle = createTurtle<decltype(set)::value>(vertexArray);
+		turtle.setAttributes(attributes);
+		turtle.setPolygons(triangulator.get());
+		visitNextGeneration([&](const char symbol, const float *parameters, const unsigned int arity) {
+			turtle.consume(symbol, parameters, arity);
+		});
+	});
+	if (triangulator)
+		triangulator->finish();
 	return vertexArray;
 }
 
+unsigned long long LSystem::writeNextGeneration(ostream &stream, array<PipelineStage, 3> *stages) {
+	constexpr size_t CHUNK_SYMBOLS = 1 << 16;
+	constexpr size_t CHUNK_VERTICES = 1 << 16; //a vertex chunk is sent once it holds at least this many
+	constexpr size_t BUFFERED_CHUNKS = 16;
+	typedef vector<array<float, 3>> VertexChunk;
+	PipelineStage &derivation = (*stages)[0], &interpretation = (*stages)[1], &writing = (*stages)[2];
+	derivation = { "derivation", "symbols", 0, 0.0, 0.0 };
+	interpretation = { "turtle", "symbols", 0, 0.0, 0.0 };
+	writing = { "writer", "vertices", 0, 0.0, 0.0 };
+	//symbol chunks carry arities and parameters only for parametric generations
+	RingBuffer<ParametricString> symbolChunks(BUFFERED_CHUNKS);
+	RingBuffer<VertexChunk> vertexChunks(BUFFERED_CHUNKS);
+
+	thread deriving([&]() {
+		const auto start = chrono::steady_clock::now();
+		const bool parametric = !_parametric_rules.empty();
+		ParametricString chunk;
+		chunk.symbols.reserve(CHUNK_SYMBOLS);
+		visitNextGeneration([&](const char symbol, const float *parameters, const unsigned int arity) {
+			chunk.symbols.push_back(symbol);
+			if (parametric) {
+				chunk.arities.push_back((unsigned char)arity);
+				chunk.parameters.insert(chunk.parameters.end(), parameters, parameters + arity);
+			}
+			if (chunk.symbols.size() == CHUNK_SYMBOLS) {
+				derivation.items += CHUNK_SYMBOLS;
+				symbolChunks.push(chunk, derivation.stalled_seconds);
+				chunk.clear();
+				chunk.symbols.reserve(CHUNK_SYMBOLS);
+			}
+		});
+		if (!chunk.symbols.empty()) {
+			derivation.items += chunk.symbols.size();
+			symbolChunks.push(chunk, derivation.stalled_seconds);
+		}
+		symbolChunks.close();
+		derivation.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	});
+	thread interpreting([&]() {
+		const auto start = chrono::steady_clock::now();
+		VertexChunk vertices;
+		Turtle turtle = createTurtle<0>(&vertices);
+		ParametricString chunk;
+		while (symbolChunks.pop(chunk, interpretation.stalled_seconds)) {
+			interpretation.items += chunk.symbols.size();
+			if (chunk.arities.empty()) {
+				for (const char &symbol : chunk.symbols)
+					turtle.consume(symbol);
+			}
+			else {
+				const float *parameters = chunk.parameters.data();
+				for (size_t i = 0; i < chunk.symbols.size(); i++) {
+					turtle.consume(chunk.symbols[i], parameters, chunk.arities[i]);
+					parameters += chunk.arities[i];
+				}
+			}
+			//the last vertex stays, a merged segment can still extend it
+			if (vertices.size() >= CHUNK_VERTICES) {
+				const array<float, 3> last = vertices.back();
+				vertices.pop_back();
+				vertexChunks.push(vertices, interpretation.stalled_seconds);
+				vertices.clear();
+				vertices.push_back(last);
+			}
+		}
+		if (!vertices.empty())
+			vertexChunks.push(vertices, interpretation.stalled_seconds);
+		vertexChunks.close();
+		interpretation.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	});
+
+	const auto start = chrono::steady_clock::now();
+	VertexChunk vertices;
+	while (vertexChunks.pop(vertices, writing.stalled_seconds)) {
+		stream.write((const char*)vertices.data(), sizeof(array<float, 3>) * vertices.size());
+		writing.items += vertices.size();
+	}
+	writing.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	deriving.join();
+	interpreting.join();
+	return writing.items;
+}
+
 /*#########*/
 
 LSystem* getDefaultLSystems(LSystemCode choice) {
@@ -174,6 +701,16 @@ LSystem* getDefaultLSystems(LSystemCode choice) {
 		lsystem = new LSystem("F++F++F", { { "F", "F-F++F-Fs" }}, "F", M_PI/3.0f);
 		lsystem->setStartingAngle(0.0f);
 		break;
+	case BUSHES3D:
+		lsystem = new LSystem("A", { { "A", "[&FA]/////[&FA]///////[&FA]" }, { "F", "S/////F" }, { "S", "F" } }, "F", M_PI / 8.0f);
+		lsystem->setStartingAngle(M_PI / 2.0f);
+		break;
+	case LEAFY_PLANT:
+		//the fractal plant with a leaf at the end of the side branches, a fan of vertices around the leaf stalk.
+		//G only moves inside the leaves, it has no rule so they keep their size
+		lsystem = new LSystem("X", { { "X", "F-[[X]+X]+F[+FXL]-XL" }, { "F", "FF" }, { "L", "[{.[--GG.][-GGG.][GGGG.][+GGG.][++GG.]}]" } }, "FG", M_PI*25.0f/180.0f);
+		lsystem->setStartingAngle(M_PI / 2.0f);
+		break;
 	default:
 		lsystem = NULL;
 	}
@@ -187,19 +724,47 @@ LSystem* getCustomLSystem() {
 	
 	cout << "Insert starting status: ";
 	cin >> input;
+	ParametricString modules;
+	while (!parseModules(input, &modules)) {
+		cout << "INVALID STATUS: MALFORMED PARAMETERS" << endl;
+		cin >> input;
+	}
 	lsystem->setStatus(&input);
 
 	cout << "Insert rules (type exit to stop):" << endl;
 	cout << "Ex F=FF" << endl;
+	cout << "Weighted alternatives for the same condition: F~0.3=F[+F]F F~0.7=F[-F]F" << endl;
+	cout << "Context sensitive, + and - are skipped: A<B>C=X A<B=X B>C=X" << endl;
+	cout << "Parametric, without spaces: A(t):t>0->F(t*0.8)[+(30)A(t-1)]" << endl;
 	while(1) {
 		cin >> input;
 		if (input == "exit")
 			break;
+		else if (input.find("->") != string::npos) {
+			if (!lsystem->addParametricRule(&input))
+				cout << "INVALID RULE: MALFORMED PARAMETRIC RULE" << endl;
+		}
 		else if(input.find('=') == string::npos) {
 			cout << "INVALID RULE: NO = present" << endl;
 		}
-		else
-			lsystem->addRule(&input.substr(0, input.find('=')), &input.substr(input.find('=') + 1));
+		else {
+			string condition = input.substr(0, input.find('=')), expansion = input.substr(input.find('=') + 1);
+			const size_t weightStart = condition.find('~');
+			if (weightStart == string::npos)
+				lsystem->addRule(&condition, &expansion);
+			else {
+				float weight;
+				try {
+					weight = stof(condition.substr(weightStart + 1));
+				}
+				catch (const exception &) {
+					cout << "INVALID RULE: WEIGHT IS NOT A NUMBER" << endl;
+					continue;
+				}
+				condition.erase(weightStart);
+				lsystem->addStochasticRule(&condition, &expansion, weight);
+			}
+		}
 	} 
 	cout << "Insert drawing variables: ";
 	cin >> input;
@@ -258,6 +823,12 @@ string getLSystemFileName(const LSystemCode lsystemcode, const unsigned int numb
 	case SNOWFLAKE1:
 		filename = "snowflake1_vertices";
 		break;
+	case BUSHES3D:
+		filename = "bushes3d_vertices";
+		break;
+	case LEAFY_PLANT:
+		filename = "leafy_plant_vertices";
+		break;
 	default:
 		filename = "default";
 	}
@@ -274,10 +845,11 @@ void printLSystemOptions() {
 		"SIMPLE_CURVE1		7" << std::endl << "SIMPLE_CURVE2		8" << std::endl <<
 		"BUSHES1			9" << std::endl << "BUSHES2			10" << std::endl <<
 		"BUSHES3			11" << std::endl << "BUSHES4			12" << std::endl <<
-		"CRYSTALS		13" << std::endl << "SNOWFLAKE1		14" << std::endl;
+		"CRYSTALS		13" << std::endl << "SNOWFLAKE1		14" << std::endl <<
+		"BUSHES3D		15" << std::endl << "LEAFY_PLANT		16" << std::endl;
 }
 
-void lsGenData(unsigned int choice, unsigned int numberOfIterations, std::string output_filename) {
+bool lsGenData(unsigned int choice, unsigned int numberOfIterations, std::string output_filename, const LSGenOptions &options) {
 	cout << "Retrieving LSystem ";
 	
 	LSystem *lsystem = nullptr;
@@ -288,28 +860,154 @@ void lsGenData(unsigned int choice, unsigned int numberOfIterations, std::string
 		lsystem = getDefaultLSystems((LSystemCode)choice);
 		if (lsystem == NULL) {
 			cout << endl << "ERROR: coulnd't get selected L-System" << endl;
-			return;
+			return false;
 		}
 	}
 
 	//write only if there's no file with the same name
 	//avoids wasting recreating files for implemented L-Systems
 	
+	//refuse generations that wouldn't fit in memory before allocating anything.
+	//merged moves make fewer segments than drawing symbols, the estimate is then an upper bound
+	//fused and pipelined generations never store the last generation, pipelined ones neither its vertices
+	const bool streamed = (options.fused || options.pipelined) && !options.compiled && numberOfIterations > 0;
+	const bool polygons = options.polygons && lsystem->hasPolygons();
+	//tubes are sized by the depth and width of their segment
+	const unsigned int attributeSet = (options.attributes | (options.tubes == TUBES_OFF ? 0 : ATTRIBUTE_DEPTH | ATTRIBUTE_WIDTH)) & ATTRIBUTE_ALL;
+	const bool indexed = options.indexed && options.attributes == 0, strips = options.strips && options.attributes == 0;
+	const bool pipelined = streamed && options.pipelined && !indexed && !strips && attributeSet == 0 && !polygons;
+	const TubeOptions tubeOptions;
+	GrowthPrediction prediction;
+	if (lsystem->predictGrowth(numberOfIterations, &prediction)) {
+		//two vertices per segment and their attributes, with tubes also a tube and for a mesh 6 vertices per side of the tube
+		const unsigned long long segmentBytes = 2 * sizeof(array<float, 3>) + (attributeSet == 0 ? 0 : 2 * sizeof(VertexAttributes)) +
+			(options.tubes == TUBES_OFF ? 0 : sizeof(TubeInstance) + (options.tubes == TUBES_MESH ? 6ull * tubeOptions.sides * sizeof(array<float, 3>) : 0));
+		unsigned long long requiredBytes = prediction.drawing_symbols >= ULLONG_MAX / segmentBytes ?
+			ULLONG_MAX : prediction.drawing_symbols * segmentBytes;
+		if (pipelined)
+			requiredBytes = 0;
+		//the eager strategies also hold the last two generations, the packed one at the bits per symbol of its
+		//alphabet, the lazy and dag ones none
+		//when streamed the last generation is never stored, the eager strategies hold the two before it
+		unsigned long long statusBytes = 0;
+		GrowthPrediction previous;
+		if ((options.derivation == DERIVE_EAGER || options.derivation == DERIVE_KSTEP) && streamed)
+			statusBytes = numberOfIterations > 0 && lsystem->predictGrowth(numberOfIterations - 1, &previous) ? previous.length : 0;
+		else if (options.derivation == DERIVE_EAGER || options.derivation == DERIVE_KSTEP)
+			statusBytes = prediction.length;
+		else if (options.derivation == DERIVE_PACKED) {
+			const unsigned long long bits = lsystem->packedBitsPerSymbol();
+			statusBytes = prediction.length / 8 * bits + prediction.length % 8 * bits / 8;
+		}
+		requiredBytes = statusBytes > (ULLONG_MAX - requiredBytes) / 2 ? ULLONG_MAX : requiredBytes + 2 * statusBytes;
+		const char *bound = options.merge_collinear ? "at most " : "";
+		cout << "Expected " << prediction.length << " symbols, " << bound << prediction.drawing_symbols << " segments, bracket depth " << prediction.max_depth << endl;
+		if (requiredBytes > options.memory_limit) {
+			cout << "ERROR: the L-System " << (options.merge_collinear ? "could" : "would") << " need more than " << (options.memory_limit >> 20) << " MB" << endl;
+			delete lsystem;
+			return false;
+		}
+	}
+
 	cout << "Generating Points..." << endl << endl;
-	lsystem->doIterations(numberOfIterations);
-	vector<array<float, 3>> *vertexArray = lsystem->translateStatus();
+	lsystem->setDerivationStrategy(options.derivation);
+	lsystem->setSeed(options.seed);
+	lsystem->setMergeCollinear(options.merge_collinear);
+	if (pipelined) {
+		lsystem->doIterations(numberOfIterations - 1);
+		cout << "Generating and writing the last generation on default temporary file " << endl;
+		ofstream file(output_filename, ios::out | ios::binary | ios::trunc);
+		if (!file.is_open()) {
+			cout << "Failed to open file..." << endl << endl << endl;
+			delete lsystem;
+			return false;
+		}
+		array<PipelineStage, 3> stages;
+		const unsigned long long vertices = lsystem->writeNextGeneration(file, &stages);
+		file.close();
+		cout << "Finished writing " << vertices << " vertices..closing file" << endl;
+		for (const PipelineStage &stage : stages) {
+			const double busy = stage.seconds - stage.stalled_seconds;
+			cout << stage.name << ": " << stage.items << " " << stage.unit << " in " << stage.seconds << " s, " <<
+				(busy > 0.0 ? stage.items / busy : 0.0) << " " << stage.unit << "/s while busy, stalled " << stage.stalled_seconds << " s" << endl;
+		}
+		cout << endl << endl;
+		delete lsystem;
+		return file.good();
+	}
+	vector<array<float, 3>> *vertexArray;
+	Geometry geometry;
+	vector<VertexAttributes> *attributes = attributeSet == 0 ? nullptr : &geometry.attributes;
+	vector<array<float, 3>> *leaves = polygons ? &geometry.triangles : nullptr;
+	if (streamed) {
+		lsystem->doIterations(numberOfIterations - 1);
+		vertexArray = lsystem->translateNextGeneration(attributeSet, attributes, leaves);
+	}
+	else {
+		lsystem->doIterations(numberOfIterations);
+		if (options.compiled && lsystem->compileTurtleProgram()) {
+			const TurtleProgram *program = lsystem->getTurtleProgram();
+			cout << "Compiled " << program->symbols() << " symbols into " << program->size() << " turtle instructions" << endl;
+		}
+		vertexArray = lsystem->translateStatus(attributeSet, attributes, leaves);
+	}
 
 	cout << "Finished generation of " << vertexArray->size() << " vertices..." << endl;
+	if (polygons)
+		cout << "Filled polygons with " << geometry.triangles.size() / 3 << " triangles" << endl;
+	if (options.tubes != TUBES_OFF) {
+		buildTubes(*vertexArray, geometry.attributes, tubeOptions, &geometry.tubes);
+		if (options.attributes == 0)
+			vector<VertexAttributes>().swap(geometry.attributes);
+		if (options.tubes == TUBES_MESH) {
+			ThreadPool pool(max(1u, thread::hardware_concurrency()));
+			const size_t leafVertices = geometry.triangles.size();
+			tessellateTubes(geometry.tubes, tubeOptions.sides, &pool, &geometry.triangles);
+			vector<TubeInstance>().swap(geometry.tubes);
+			cout << "Tessellated into " << (geometry.triangles.size() - leafVertices) / 3 << " triangles" << endl;
+		}
+		else
+			cout << "Built " << geometry.tubes.size() << " tubes" << endl;
+	}
+	if (indexed != options.indexed || strips != options.strips)
+		cout << "Vertices with attributes are written unindexed" << endl;
+	if (indexed) {
+		if (weldLines(*vertexArray, &geometry))
+			cout << "Welded into " << geometry.vertices.size() << " vertices and " << geometry.lines.size() / 2 << " segments" << endl;
+		else
+			cout << "Too many vertices to index, writing them unwelded" << endl;
+	}
+	if (strips) {
+		const bool welded = geometry.isIndexed();
+		if (!welded)
+			geometry.vertices.swap(*vertexArray);
+		if (stripLines(&geometry))
+			cout << "Joined into " << count(geometry.strips.begin(), geometry.strips.end(), STRIP_RESTART) + (geometry.strips.empty() ? 0 : 1) <<
+				" strips of " << geometry.vertices.size() << " vertices" << endl;
+		else {
+			cout << "Strips would not be smaller, writing segments" << endl;
+			if (!welded)
+				geometry.vertices.swap(*vertexArray);
+		}
+	}
 	cout << "Starting writing on default temporary file " << endl;
 	ofstream file(output_filename, ios::out | ios::binary | ios::trunc);
 	if (file.is_open()) {
-		file.write((char*)&vertexArray->front()[0], sizeof(array<float, 3>)*vertexArray->size());
+		if (!geometry.isPlain()) {
+			if (!geometry.isIndexed())
+				geometry.vertices.swap(*vertexArray);
+			writeGeometry(file, geometry);
+		}
+		else
+			file.write((char*)&vertexArray->front()[0], sizeof(array<float, 3>)*vertexArray->size());
 		file.close();
 		cout << "Finished writing..closing file" << endl << endl << endl;
 	}
 	else
 		cout << "Failed to open file..." << endl << endl << endl;
+	const bool written = file.good();
 
 	delete vertexArray;
 	delete lsystem;
+	return written;
 }
\ No newline at end of file
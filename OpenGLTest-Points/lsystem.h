@@ -3,6 +3,18 @@
 
 #include <string>
 #include <vector>
+#include <array>
+#include <memory>
+#include <cstdint>
+#include "rulematcher.h"
+#include "threadpool.h"
+#include "derivation.h"
+#include "compactstatus.h"
+#include "parametric.h"
+#include "geometry.h"
+#include "turtleprogram.h"
+
+template<unsigned int ATTRIBUTES> class BasicTurtle;
 
 enum LSystemCode { //raccomended number of iterations
 	CUSTOM_SYSTEM,
@@ -20,39 +32,149 @@ enum LSystemCode { //raccomended number of iterations
 	BUSHES4, //11
 	CRYSTALS, //3
 	SNOWFLAKE1, // 3
+	BUSHES3D, //7
+	LEAFY_PLANT, //5
+};
+
+enum DerivationStrategy {
+	DERIVE_EAGER, //every generation is stored in the status
+	DERIVE_LAZY, //the last generation is produced on demand while it is being read
+	DERIVE_DAG, //the last generation is kept as a graph of shared symbol expansions
+	DERIVE_KSTEP, //like eager but applies several iterations per pass through composed rules
+	DERIVE_PACKED, //generations are stored with 2, 4 or 8 bits per symbol
+	DERIVE_RLE, //generations are stored as runs of equal symbols
+};
+
+enum TubeOutput {
+	TUBES_OFF, //segments are drawn as lines
+	TUBES_INSTANCED, //segments are also written as tubes, instances of a shared cylinder
+	TUBES_MESH, //the tubes are written as triangles, for export
+};
+
+//lsGenData drops the options that cannot be combined with the others
+struct LSGenOptions {
+	DerivationStrategy derivation = DERIVE_EAGER;
+	unsigned long long memory_limit = 4ull << 30; //bytes, larger generations are refused before starting
+	unsigned long long seed = 0; //of the stochastic choices
+	bool fused = false; //the last generation is interpreted while it is derived
+	bool pipelined = false; //the last generation is derived, interpreted and written concurrently
+	bool indexed = false; //vertices written once, with an index buffer
+	bool strips = false; //connected segments written as line strips
+	bool merge_collinear = false; //collinear moves drawn as one segment
+	TubeOutput tubes = TUBES_OFF; //segments drawn as tubes sized by depth and width
+	unsigned int attributes = 0; //VertexAttribute flags written for every vertex
+	bool polygons = true; //polygons between { and } are filled
+	bool compiled = false; //the last generation is interpreted from compiled turtle instructions
+};
+
+//work of a stage of the pipelined generation. the stall time is spent waiting on an empty input or a full output
+struct PipelineStage {
+	const char *name, *unit;
+	unsigned long long items;
+	double seconds, stalled_seconds;
 };
 
 /*Main function*/
-//generates binary file with vertices and gives back the name
-//return blank string if has an error
-void lsGenData(unsigned int choice, unsigned int numberOfIterations, std::string output_filename);
+//generates binary file with vertices
+//returns false if the L-System couldn't be generated
+bool lsGenData(unsigned int choice, unsigned int numberOfIterations, std::string output_filename, const LSGenOptions &options = LSGenOptions());
 void printLSystemOptions();
 std::string getLSystemFileName(const LSystemCode lsystemcode, const unsigned int numberOfIterations);
 
 
-typedef std::pair<std::string, std::string> rule;
 class LSystem {
 private: 
 	std::string _status, _drawing_variables; //default drawing variable F
 	std::vector<rule> _rules;
-	std::vector<std::pair<std::string, unsigned int>> getRulesInstances();
+	std::vector<StochasticRule> _stochastic_rules;
+	std::vector<std::string> _parametric_rules; //validated text, compiled with the plain rules when deriving
+	RuleMatcher _matcher; //compiled from _rules and _stochastic_rules every time they change
+	unsigned int _generation; //iterations applied since the status was set, keys the stochastic choices
+	unsigned int _thread_count; //threads used to rewrite a generation, 1 runs everything on the caller
+	std::unique_ptr<ThreadPool> _pool; //created on the first iteration that needs it
+	DerivationStrategy _derivation_strategy;
+	unsigned int _pending_iterations; //iterations not yet applied to _status by the lazy, dag, packed and rle strategies
+	std::unique_ptr<DerivationDag> _dag; //_status after the pending iterations, dag strategy only
+	std::unique_ptr<SymbolAlphabet> _alphabet; //codes of _packed
+	std::unique_ptr<PackedString> _packed; //_status after the pending iterations, packed strategy only
+	void derivePacked(const unsigned int numberOfIterations);
+	std::unique_ptr<RunString> _runs; //_status after the pending iterations, rle strategy only
+	void deriveRuns(const unsigned int numberOfIterations);
+	std::unique_ptr<ParametricString> _modules; //_status after the pending iterations, parametric rules only
+	void deriveParametric(const unsigned int numberOfIterations);
+	std::unique_ptr<TurtleProgram> _program; //the status compiled for the turtle, dropped when the status or the drawing variables change
+	ParametricRules compileParametricRules() const;
+	void prepareModules();
+	void applyPendingIterations();
+	template<class Visitor> void visitNextGeneration(Visitor &&visitor);
+	unsigned int compositionSteps(const unsigned int numberOfIterations) const;
 	float _turning_angle, _starting_angle;
+	bool _merge_collinear;
+	bool _three_dimensional; //the status or an expansion has & ^ \ / |, the turtle then moves in space
+	bool _polygons; //the status or an expansion has {, polygons can be filled
+	void detectTurtleModes();
+	void noteTurtleModes(const std::string &symbols);
+	template<unsigned int ATTRIBUTES> BasicTurtle<ATTRIBUTES> createTurtle(std::vector<std::array<float, 3>> *vertices) const;
 public:
 	LSystem();
 	LSystem(const std::string *status, const std::vector<std::pair<std::string, std::string>> *rules, const std::string *drawing_variables, const float turning_angle);
 	LSystem(const char *status, const std::vector<std::pair<std::string, std::string>> rules, const char *drawing_variables, const float turning_angle);
 	void doIterations(const unsigned int numberOfIterations);
-	std::vector<std::array<float, 3>> *translateStatus();
+	//attributes, when given, receives the attributeSet attributes of every vertex (VertexAttribute flags) and
+	//triangles the polygons between { and }, three vertices per triangle
+	std::vector<std::array<float, 3>> *translateStatus(const unsigned int attributeSet = 0, std::vector<VertexAttributes> *attributes = nullptr,
+		std::vector<std::array<float, 3>> *triangles = nullptr);
+	//vertices of the generation after the status, fed to the turtle while it is derived without storing it.
+	//the status is left unchanged
+	std::vector<std::array<float, 3>> *translateNextGeneration(const unsigned int attributeSet = 0, std::vector<VertexAttributes> *attributes = nullptr,
+		std::vector<std::array<float, 3>> *triangles = nullptr);
+	//writes the vertices of the generation after the status to stream, derived, interpreted and written in chunks
+	//by three concurrent stages, the same bytes as the vertices of the next generation interpreted after deriving it.
+	//the status is left unchanged, returns the number of vertices
+	unsigned long long writeNextGeneration(std::ostream &stream, std::array<PipelineStage, 3> *stages);
+
+	//compiles the status into turtle instructions, interpreted from then on by translateStatus until the status
+	//or the drawing variables change. new angles keep the program. false with parametric rules
+	bool compileTurtleProgram();
+	//nullptr when the status is not compiled
+	const TurtleProgram *getTurtleProgram() const { return _program.get(); }
 
 	void setStatus(const std::string *status);
 	void setRules(const std::vector<rule> *rules);
 	void addRule(const std::string *condition, const std::string *expansion);
+	//adds a weighted expansion, conditions given more than once pick one of their expansions at every occurrence
+	void addStochasticRule(const std::string *condition, const std::string *expansion, const float weight);
+	void setSeed(const unsigned long long seed);
+	//symbols skipped when matching the context of l<s>r rules, + and - by default
+	void setContextIgnored(const std::string *symbols);
+	//rule such as A(t):t>0->F(t*0.8)[+A(t-1)], false if it is malformed. once one is added the status is
+	//derived as parametric modules, the plain rules take part as rules without parameters and the
+	//stochastic rules and multi character conditions are not applied
+	bool addParametricRule(const std::string *rule);
 	void setStartingAngle(const float starting_angle);
 	void setTurningAngle(const float turning_angle);
 	void setDrawingVariables(const std::string *drawing_variables);
+	void setThreadCount(const unsigned int thread_count);
+	void setDerivationStrategy(const DerivationStrategy strategy);
+	void setMergeCollinear(const bool merge);
+
+	//exact size of the status after numberOfIterations more iterations, computed without deriving it.
+	//false if the rules are not context free, are stochastic or parametric
+	bool predictGrowth(const unsigned int numberOfIterations, GrowthPrediction *prediction);
+	//bits of a symbol of the status stored by the packed strategy
+	unsigned int packedBitsPerSymbol() const;
 
 	std::string getStatus();
+	//length and export of the status that don't flatten deferred generations
+	unsigned long long getStatusLength();
+	void writeStatus(std::ostream &stream);
 	std::vector<std::pair<std::string, std::string>> getRules();
+	std::vector<StochasticRule> getStochasticRules();
+	std::vector<std::string> getParametricRules();
 	float getStartingAngle();
+	//whether the generations can have polygons to fill
+	bool hasPolygons() const { return _polygons; }
 };
+
+LSystem* getDefaultLSystems(LSystemCode choice);
 #endif // !GENDATA_H
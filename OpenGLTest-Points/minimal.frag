@@ -9,8 +9,7 @@ out vec4 out_Color;
 
 void main(void)
 {
-	out_Color = vec4(0.0, 1.0, 0.0, 1.0);
-	//out_Color = vec4(ex_Color, 1.0);
+	out_Color = vec4(ex_Color, 1.0);
 	//Try replacing the above with the following:
 	//vec3 tmp_Color;
 	//tmp_Color = ex_Color.rrr;	
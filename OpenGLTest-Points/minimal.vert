@@ -5,12 +5,18 @@
 uniform mat4 mvp;
 
 in  vec3 in_Position;
-in  vec3 in_Color;
+in  vec2 in_Attributes; //bracket depth and color index, bytes normalized to [0, 1]
 out vec3 ex_Color;
 
+//colors picked by the color index, the first is the green of vertices without attributes
+const vec3 palette[8] = vec3[8](vec3(0.0, 1.0, 0.0), vec3(0.55, 0.35, 0.15), vec3(0.9, 0.2, 0.1), vec3(1.0, 0.85, 0.2),
+	vec3(1.0, 0.5, 0.1), vec3(0.6, 0.3, 0.8), vec3(0.95, 0.95, 0.95), vec3(0.2, 0.5, 1.0));
+
 void main(void)
 {
-	//ex_Color = vec3(0.0, 1.0, 0.0);
-	ex_Color = in_Color;
+	//deeper branches are darker
+	float depth = in_Attributes.x * 255.0;
+	int index = int(in_Attributes.y * 255.0 + 0.5) % 8;
+	ex_Color = palette[index] * (0.4 + 0.6 * pow(0.85, depth));
 	gl_Position = mvp * vec4(in_Position, 1.0);
 }
\ No newline at end of file
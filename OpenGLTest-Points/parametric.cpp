@@ -0,0 +1,511 @@
+#include "parametric.h"
+#include "threadpool.h"
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+using namespace std;
+
+//deeper expressions are refused when compiled, the evaluation stack is then a fixed array
+constexpr unsigned int MAX_STACK_DEPTH = 32;
+//below this number of modules a generation is rewritten serially
+constexpr size_t PARALLEL_REWRITE_THRESHOLD = 1 << 15;
+constexpr unsigned int CHUNKS_PER_THREAD = 4;
+
+/*ParametricString*/
+
+void ParametricString::swap(ParametricString &other) {
+	symbols.swap(other.symbols);
+	arities.swap(other.arities);
+	parameters.swap(other.parameters);
+}
+
+string ParametricString::format() const {
+	string text;
+	char number[32];
+	const float *parameter = parameters.data();
+	for (size_t i = 0; i < symbols.size(); i++) {
+		text.push_back(symbols[i]);
+		for (unsigned int j = 0; j < arities[i]; j++) {
+			snprintf(number, sizeof(number), "%.9g", *parameter++); //enough digits to read back the same float
+			text.push_back(j == 0 ? '(' : ',');
+			text.append(number);
+		}
+		if (arities[i] > 0)
+			text.push_back(')');
+	}
+	return text;
+}
+
+/*Expression compiler*/
+//recursive descent over the usual precedence levels, lowest first:
+//| (or ||), & (or &&), comparisons, + -, * /, unary - and !, ^ (right associative), numbers, names and parentheses.
+//operations on constants are folded while compiling, an argument such as 2*0.5 becomes a single constant
+class ExpressionCompiler {
+private:
+	typedef ParametricRules::Instruction Instruction;
+	const string &_text;
+	size_t _position;
+	const vector<string> &_formals;
+	vector<Instruction> &_code;
+
+	bool accept(const char *token) {
+		size_t length = 0;
+		while (token[length] != '\0' && _position + length < _text.size() && _text[_position + length] == token[length])
+			length++;
+		if (token[length] != '\0')
+			return false;
+		_position += length;
+		return true;
+	}
+	char peek() const { return _position < _text.size() ? _text[_position] : '\0'; }
+
+	void emitLoad(const ParametricRules::Source source, const unsigned char parameter, const float constant) {
+		_code.push_back({ ParametricRules::OP_LOAD, source, parameter, constant });
+	}
+	void emitUnary(const ParametricRules::Operation operation) {
+		Instruction &last = _code.back();
+		if (last.operation == ParametricRules::OP_LOAD && last.source == ParametricRules::FROM_CONSTANT)
+			last.constant = ParametricRules::apply(operation, last.constant, 0.0f);
+		else
+			_code.push_back({ operation, ParametricRules::FROM_CONSTANT, 0, 0.0f });
+	}
+	//an operand ending with a load is that single load, anything longer ends with an operation
+	void emitBinary(const ParametricRules::Operation operation) {
+		const size_t size = _code.size();
+		Instruction &right = _code[size - 1];
+		if (right.operation != ParametricRules::OP_LOAD)
+			_code.push_back({ operation, ParametricRules::FROM_STACK, 0, 0.0f });
+		else if (right.source == ParametricRules::FROM_CONSTANT && _code[size - 2].operation == ParametricRules::OP_LOAD && _code[size - 2].source == ParametricRules::FROM_CONSTANT) {
+			_code[size - 2].constant = ParametricRules::apply(operation, _code[size - 2].constant, right.constant);
+			_code.pop_back();
+		}
+		else
+			right.operation = operation; //immediate right operand
+	}
+
+	bool parseOr() {
+		if (!parseAnd())
+			return false;
+		while (accept("||") || accept("|")) {
+			if (!parseAnd())
+				return false;
+			emitBinary(ParametricRules::OP_OR);
+		}
+		return true;
+	}
+	bool parseAnd() {
+		if (!parseComparison())
+			return false;
+		while (accept("&&") || accept("&")) {
+			if (!parseComparison())
+				return false;
+			emitBinary(ParametricRules::OP_AND);
+		}
+		return true;
+	}
+	bool parseComparison() {
+		if (!parseSum())
+			return false;
+		ParametricRules::Operation operation;
+		if (accept("<="))
+			operation = ParametricRules::OP_LESS_EQUAL;
+		else if (accept(">="))
+			operation = ParametricRules::OP_GREATER_EQUAL;
+		else if (accept("=="))
+			operation = ParametricRules::OP_EQUAL;
+		else if (accept("!="))
+			operation = ParametricRules::OP_NOT_EQUAL;
+		else if (accept("<"))
+			operation = ParametricRules::OP_LESS;
+		else if (accept(">"))
+			operation = ParametricRules::OP_GREATER;
+		else
+			return true;
+		if (!parseSum())
+			return false;
+		emitBinary(operation);
+		return true;
+	}
+	bool parseSum() {
+		if (!parseProduct())
+			return false;
+		while (peek() == '+' || peek() == '-') {
+			const ParametricRules::Operation operation = _text[_position++] == '+' ? ParametricRules::OP_ADD : ParametricRules::OP_SUBTRACT;
+			if (!parseProduct())
+				return false;
+			emitBinary(operation);
+		}
+		return true;
+	}
+	bool parseProduct() {
+		if (!parseUnary())
+			return false;
+		while (peek() == '*' || peek() == '/') {
+			const ParametricRules::Operation operation = _text[_position++] == '*' ? ParametricRules::OP_MULTIPLY : ParametricRules::OP_DIVIDE;
+			if (!parseUnary())
+				return false;
+			emitBinary(operation);
+		}
+		return true;
+	}
+	bool parseUnary() {
+		if (peek() == '-' || peek() == '!') {
+			const ParametricRules::Operation operation = _text[_position++] == '-' ? ParametricRules::OP_NEGATE : ParametricRules::OP_NOT;
+			if (!parseUnary())
+				return false;
+			emitUnary(operation);
+			return true;
+		}
+		return parsePower();
+	}
+	bool parsePower() {
+		if (!parsePrimary())
+			return false;
+		if (accept("^")) {
+			if (!parseUnary())
+				return false;
+			emitBinary(ParametricRules::OP_POWER);
+		}
+		return true;
+	}
+	bool parsePrimary() {
+		const char current = peek();
+		if (isdigit((unsigned char)current) || current == '.') {
+			const char *begin = _text.c_str() + _position;
+			char *end;
+			const float value = strtof(begin, &end);
+			if (end == begin)
+				return false;
+			_position += end - begin;
+			emitLoad(ParametricRules::FROM_CONSTANT, 0, value);
+			return true;
+		}
+		if (isalpha((unsigned char)current) || current == '_') {
+			const size_t begin = _position;
+			while (isalnum((unsigned char)peek()) || peek() == '_')
+				_position++;
+			const string name = _text.substr(begin, _position - begin);
+			for (size_t i = 0; i < _formals.size(); i++) {
+				if (_formals[i] == name) {
+					emitLoad(ParametricRules::FROM_PARAMETER, (unsigned char)i, 0.0f);
+					return true;
+				}
+			}
+			return false; //unknown parameter
+		}
+		if (accept("(")) {
+			if (!parseOr())
+				return false;
+			return accept(")");
+		}
+		return false;
+	}
+public:
+	ExpressionCompiler(const string &text, const size_t position, const vector<string> &formals, vector<Instruction> &code) :
+		_text(text), _position(position), _formals(formals), _code(code) {}
+	size_t position() const { return _position; }
+
+	//compiles the expression starting at position up to the first character that can't continue it
+	bool compile(ParametricRules::Expression *expression) {
+		const size_t start = _code.size();
+		if (!parseOr()) {
+			_code.resize(start);
+			return false;
+		}
+		unsigned int depth = 0, maxDepth = 0;
+		for (size_t i = start; i < _code.size(); i++) {
+			if (_code[i].operation == ParametricRules::OP_LOAD)
+				maxDepth = max(maxDepth, ++depth);
+			else if (_code[i].source == ParametricRules::FROM_STACK)
+				depth--;
+		}
+		if (maxDepth > MAX_STACK_DEPTH) {
+			_code.resize(start);
+			return false;
+		}
+		expression->first = (unsigned int)start;
+		expression->count = (unsigned int)(_code.size() - start);
+		return true;
+	}
+
+	//modules of a successor: symbols, each optionally followed by its arguments in parentheses
+	static bool parseSuccessor(const string &text, const vector<string> &formals, vector<Instruction> &code,
+			vector<ParametricRules::Expression> &expressions, string &symbols, vector<unsigned char> &arities) {
+		size_t position = 0;
+		while (position < text.size()) {
+			const char symbol = text[position++];
+			if (symbol == '(' || symbol == ')')
+				return false;
+			unsigned int arity = 0;
+			if (position < text.size() && text[position] == '(') {
+				do {
+					ExpressionCompiler compiler(text, position + 1, formals, code);
+					ParametricRules::Expression expression;
+					if (!compiler.compile(&expression) || ++arity > 255)
+						return false;
+					expressions.push_back(expression);
+					position = compiler.position();
+				} while (position < text.size() && text[position] == ',');
+				if (position == text.size() || text[position] != ')')
+					return false;
+				position++;
+			}
+			symbols.push_back(symbol);
+			arities.push_back((unsigned char)arity);
+		}
+		return true;
+	}
+};
+
+static string removeWhitespace(const string &text) {
+	string stripped;
+	for (const char &current : text) {
+		if (!isspace((unsigned char)current))
+			stripped.push_back(current);
+	}
+	return stripped;
+}
+
+bool parseModules(const string &text, ParametricString *modules) {
+	ParametricRules constants;
+	const vector<string> formals;
+	modules->clear();
+	if (!ExpressionCompiler::parseSuccessor(removeWhitespace(text), formals, constants._code, constants._expressions, modules->symbols, modules->arities)) {
+		modules->clear();
+		return false;
+	}
+	for (const ParametricRules::Expression &expression : constants._expressions)
+		modules->parameters.push_back(constants.evaluate(expression, nullptr));
+	return true;
+}
+
+/*ParametricRules*/
+
+ParametricRules::ParametricRules() {
+	_first_rule.fill(NO_RULE);
+	_last_rule.fill(NO_RULE);
+	_parametric = false;
+}
+
+void ParametricRules::add(const char symbol, Rule &rule) {
+	rule.next = NO_RULE;
+	const int index = (int)_rules.size();
+	if (_last_rule[(unsigned char)symbol] == NO_RULE)
+		_first_rule[(unsigned char)symbol] = index;
+	else
+		_rules[_last_rule[(unsigned char)symbol]].next = index;
+	_last_rule[(unsigned char)symbol] = index;
+	_rules.push_back(rule);
+}
+
+bool ParametricRules::addRule(const string &text) {
+	const string stripped = removeWhitespace(text);
+	const size_t arrow = stripped.find("->");
+	if (arrow == string::npos || arrow == 0)
+		return false;
+	const size_t colon = stripped.find(':', 1);
+	const string predecessor = stripped.substr(0, min(colon, arrow));
+	const string condition = colon < arrow ? stripped.substr(colon + 1, arrow - colon - 1) : "*";
+	if (condition.empty())
+		return false;
+
+	//formal parameters, A(x,y)
+	vector<string> formals;
+	if (predecessor.size() > 1) {
+		if (predecessor[1] != '(' || predecessor.back() != ')')
+			return false;
+		size_t begin = 2;
+		while (begin < predecessor.size() - 1) {
+			size_t end = predecessor.find(',', begin);
+			if (end == string::npos)
+				end = predecessor.size() - 1;
+			const string name = predecessor.substr(begin, end - begin);
+			if (name.empty() || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+				return false;
+			for (const char &current : name) {
+				if (!isalnum((unsigned char)current) && current != '_')
+					return false;
+			}
+			formals.push_back(name);
+			begin = end + 1;
+		}
+		if (formals.size() > 255)
+			return false;
+	}
+
+	const size_t codeSize = _code.size(), expressionCount = _expressions.size();
+	Rule rule;
+	rule.arity = (unsigned char)formals.size();
+	rule.condition = NO_CONDITION;
+	if (condition != "*") {
+		ExpressionCompiler compiler(condition, 0, formals, _code);
+		Expression expression;
+		if (!compiler.compile(&expression) || compiler.position() != condition.size()) {
+			_code.resize(codeSize);
+			return false;
+		}
+		rule.condition = (int)_expressions.size();
+		_expressions.push_back(expression);
+	}
+	rule.first_argument = (unsigned int)_expressions.size();
+	if (!ExpressionCompiler::parseSuccessor(stripped.substr(arrow + 2), formals, _code, _expressions, rule.symbols, rule.arities)) {
+		_code.resize(codeSize);
+		_expressions.resize(expressionCount);
+		return false;
+	}
+	rule.argument_count = (unsigned int)_expressions.size() - rule.first_argument;
+	add(predecessor[0], rule);
+	if (rule.arity > 0 || rule.condition != NO_CONDITION || rule.argument_count > 0)
+		_parametric = true;
+	return true;
+}
+
+void ParametricRules::addPlainRule(const string &condition, const string &expansion) {
+	if (condition.size() != 1)
+		return;
+	Rule rule;
+	rule.arity = 0;
+	rule.condition = NO_CONDITION;
+	rule.symbols = expansion;
+	rule.arities.assign(expansion.size(), 0);
+	rule.first_argument = (unsigned int)_expressions.size();
+	rule.argument_count = 0;
+	add(condition[0], rule);
+}
+
+float ParametricRules::apply(const Operation operation, const float left, const float right) {
+	switch (operation) {
+	case OP_ADD: return left + right;
+	case OP_SUBTRACT: return left - right;
+	case OP_MULTIPLY: return left * right;
+	case OP_DIVIDE: return left / right;
+	case OP_POWER: return powf(left, right);
+	case OP_LESS: return left < right ? 1.0f : 0.0f;
+	case OP_GREATER: return left > right ? 1.0f : 0.0f;
+	case OP_LESS_EQUAL: return left <= right ? 1.0f : 0.0f;
+	case OP_GREATER_EQUAL: return left >= right ? 1.0f : 0.0f;
+	case OP_EQUAL: return left == right ? 1.0f : 0.0f;
+	case OP_NOT_EQUAL: return left != right ? 1.0f : 0.0f;
+	case OP_AND: return left != 0.0f && right != 0.0f ? 1.0f : 0.0f;
+	case OP_OR: return left != 0.0f || right != 0.0f ? 1.0f : 0.0f;
+	case OP_NEGATE: return -left;
+	case OP_NOT: return left == 0.0f ? 1.0f : 0.0f;
+	default: return right; //OP_LOAD
+	}
+}
+
+//the top of the stack stays in a register, t*0.8 is a load and a multiplication
+float ParametricRules::execute(const Expression &expression, const float *parameters) const {
+	array<float, MAX_STACK_DEPTH> stack;
+	unsigned int size = 0;
+	const Instruction *instruction = &_code[expression.first];
+	const Instruction *end = instruction + expression.count;
+	float top = 0.0f;
+	for (; instruction != end; instruction++) {
+		float right;
+		if (instruction->source == FROM_STACK) {
+			right = top;
+			top = stack[--size];
+		}
+		else
+			right = instruction->source == FROM_CONSTANT ? instruction->constant : parameters[instruction->parameter];
+		if (instruction->operation == OP_LOAD) {
+			stack[size++] = top;
+			top = right;
+		}
+		else
+			top = apply(instruction->operation, top, right);
+	}
+	return top;
+}
+
+//same reduce then scan scheme as RuleMatcher::rewriteParallel: the first pass sizes the output of every chunk,
+//the second one writes it in place. the rule of a module is selected again in the second pass, storing the
+//choice would cost more memory traffic than evaluating the conditions twice
+void ParametricRules::rewrite(const ParametricString &current, ParametricString &next, ThreadPool *pool) const {
+	const size_t count = current.symbols.size();
+	const size_t chunks = pool != nullptr && pool->size() > 1 && count >= PARALLEL_REWRITE_THRESHOLD ? (size_t)pool->size() * CHUNKS_PER_THREAD : 1;
+	const size_t chunkLength = (count + chunks - 1) / chunks;
+	auto forEachChunk = [&](const function<void(size_t)> &task) {
+		if (chunks > 1)
+			pool->parallelFor(chunks, task);
+		else
+			task(0);
+	};
+
+	//first parameter read by every chunk, a chunk can only find its parameters once the arities before it are summed
+	vector<size_t> reads(chunks + 1, 0);
+	if (chunks > 1) {
+		forEachChunk([&](size_t chunk) {
+			const size_t begin = min(count, chunk * chunkLength), end = min(count, begin + chunkLength);
+			size_t read = 0;
+			for (size_t i = begin; i < end; i++)
+				read += current.arities[i];
+			reads[chunk + 1] = read;
+		});
+		for (size_t chunk = 0; chunk < chunks; chunk++)
+			reads[chunk + 1] += reads[chunk];
+	}
+
+	//symbols and parameters written by every chunk
+	vector<size_t> symbolOffsets(chunks + 1, 0), parameterOffsets(chunks + 1, 0);
+	forEachChunk([&](size_t chunk) {
+		const size_t begin = min(count, chunk * chunkLength), end = min(count, begin + chunkLength);
+		const float *parameters = current.parameters.data() + reads[chunk];
+		size_t symbolCount = 0, parameterCount = 0;
+		for (size_t i = begin; i < end; i++) {
+			const unsigned char arity = current.arities[i];
+			const int index = select(current.symbols[i], arity, parameters);
+			symbolCount += index == NO_RULE ? 1 : _rules[index].symbols.size();
+			parameterCount += index == NO_RULE ? arity : _rules[index].argument_count;
+			parameters += arity;
+		}
+		symbolOffsets[chunk + 1] = symbolCount;
+		parameterOffsets[chunk + 1] = parameterCount;
+	});
+	symbolOffsets[0] = next.symbols.size();
+	parameterOffsets[0] = next.parameters.size();
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		symbolOffsets[chunk + 1] += symbolOffsets[chunk];
+		parameterOffsets[chunk + 1] += parameterOffsets[chunk];
+	}
+
+	next.symbols.resize(symbolOffsets[chunks]);
+	next.arities.resize(symbolOffsets[chunks]);
+	next.parameters.resize(parameterOffsets[chunks]);
+	forEachChunk([&](size_t chunk) {
+		const size_t begin = min(count, chunk * chunkLength), end = min(count, begin + chunkLength);
+		const float *parameters = current.parameters.data() + reads[chunk];
+		char *symbols = &next.symbols[0] + symbolOffsets[chunk];
+		unsigned char *arities = next.arities.data() + symbolOffsets[chunk];
+		float *arguments = next.parameters.data() + parameterOffsets[chunk];
+		for (size_t i = begin; i < end; i++) {
+			const unsigned char arity = current.arities[i];
+			const int index = select(current.symbols[i], arity, parameters);
+			if (index == NO_RULE) {
+				*symbols++ = current.symbols[i];
+				*arities++ = arity;
+				for (unsigned char j = 0; j < arity; j++)
+					*arguments++ = parameters[j];
+			}
+			else {
+				const Rule &rule = _rules[index];
+				//successors are a few modules, copied in place rather than by a call per array
+				const size_t length = rule.symbols.size();
+				for (size_t j = 0; j < length; j++) {
+					symbols[j] = rule.symbols[j];
+					arities[j] = rule.arities[j];
+				}
+				symbols += length;
+				arities += length;
+				const Expression *expression = &_expressions[rule.first_argument];
+				for (unsigned int j = 0; j < rule.argument_count; j++)
+					*arguments++ = evaluate(expression[j], parameters);
+			}
+			parameters += arity;
+		}
+	});
+}
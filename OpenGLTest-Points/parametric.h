@@ -0,0 +1,127 @@
+#ifndef PARAMETRIC_H
+#define PARAMETRIC_H
+
+#include <string>
+#include <vector>
+#include <array>
+
+class ThreadPool;
+
+/*Parametric modules*/
+//a generation of modules such as F(1.5,0.2), the parameters of all the modules in one float array
+struct ParametricString {
+	std::string symbols;
+	std::vector<unsigned char> arities; //number of parameters of every module
+	std::vector<float> parameters;
+
+	void clear() { symbols.clear(); arities.clear(); parameters.clear(); }
+	void swap(ParametricString &other);
+	//text form, F(1.5,0.2)+F(1)
+	std::string format() const;
+};
+
+//parses modules whose parameters are constant expressions, such as an axiom A(5)F(2*0.5).
+//false if the text is malformed, modules is then left empty
+bool parseModules(const std::string &text, ParametricString *modules);
+
+/*Compiled parametric rules*/
+//rules such as A(t):t>0->F(t*0.8)[+A(t-1)], whitespace is ignored. a module is rewritten by the first rule
+//with its symbol and arity whose condition holds, otherwise copied. expressions are compiled to stack bytecode
+class ParametricRules {
+private:
+	static constexpr int NO_RULE = -1;
+	static constexpr int NO_CONDITION = -1;
+
+	enum Operation : unsigned char {
+		OP_LOAD, //pushes the operand
+		OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE, OP_POWER,
+		OP_LESS, OP_GREATER, OP_LESS_EQUAL, OP_GREATER_EQUAL, OP_EQUAL, OP_NOT_EQUAL, OP_AND, OP_OR,
+		OP_NEGATE, OP_NOT, //unary, the operand is ignored
+	};
+	enum Source : unsigned char {
+		FROM_STACK, //right operand popped from the stack
+		FROM_CONSTANT,
+		FROM_PARAMETER,
+	};
+	struct Instruction {
+		Operation operation;
+		Source source;
+		unsigned char parameter; //FROM_PARAMETER only
+		float constant; //FROM_CONSTANT only
+	};
+	struct Expression {
+		unsigned int first, count; //range in _code
+	};
+	struct Rule {
+		unsigned char arity;
+		int condition; //index in _expressions
+		std::string symbols; //successor modules
+		std::vector<unsigned char> arities;
+		unsigned int first_argument, argument_count; //successor parameters, range in _expressions
+		int next; //next declared rule for the same symbol
+	};
+
+	std::vector<Instruction> _code;
+	std::vector<Expression> _expressions;
+	std::vector<Rule> _rules;
+	std::array<int, 256> _first_rule; //symbol -> first declared rule
+	std::array<int, 256> _last_rule;
+	bool _parametric;
+
+	void add(const char symbol, Rule &rule);
+	static float apply(const Operation operation, const float left, const float right);
+	float execute(const Expression &expression, const float *parameters) const;
+	//first rule that rewrites the module, NO_RULE if it is copied
+	int select(const char symbol, const unsigned char arity, const float *parameters) const {
+		int index = _first_rule[(unsigned char)symbol];
+		while (index != NO_RULE && (_rules[index].arity != arity ||
+			(_rules[index].condition != NO_CONDITION && evaluate(_expressions[_rules[index].condition], parameters) == 0.0f)))
+			index = _rules[index].next;
+		return index;
+	}
+	float evaluate(const Expression &expression, const float *parameters) const {
+		if (expression.count == 1) { //most arguments are a single constant or parameter
+			const Instruction &load = _code[expression.first];
+			return load.source == FROM_CONSTANT ? load.constant : parameters[load.parameter];
+		}
+		return execute(expression, parameters);
+	}
+	friend class ExpressionCompiler;
+	friend bool parseModules(const std::string &text, ParametricString *modules);
+public:
+	ParametricRules();
+	//false if the rule is malformed, it is then not added
+	bool addRule(const std::string &text);
+	//plain rule, the expansion is made of modules without parameters. single character conditions only
+	void addPlainRule(const std::string &condition, const std::string &expansion);
+	//true once a rule with parameters, a condition or parametric successors has been added
+	bool isParametric() const { return _parametric; }
+	//calls visitor(symbol, parameters, arity) for every module of the rewritten current as soon as it is produced,
+	//the rewritten generation is never stored
+	template<class Visitor> void visit(const ParametricString &current, Visitor &&visitor) const {
+		std::vector<float> arguments;
+		const float *parameters = current.parameters.data();
+		for (size_t i = 0; i < current.symbols.size(); i++) {
+			const unsigned char arity = current.arities[i];
+			const int index = select(current.symbols[i], arity, parameters);
+			if (index == NO_RULE)
+				visitor(current.symbols[i], parameters, arity);
+			else {
+				const Rule &rule = _rules[index];
+				arguments.resize(rule.argument_count);
+				for (unsigned int j = 0; j < rule.argument_count; j++)
+					arguments[j] = evaluate(_expressions[rule.first_argument + j], parameters);
+				const float *argument = arguments.data();
+				for (size_t j = 0; j < rule.symbols.size(); j++) {
+					visitor(rule.symbols[j], argument, rule.arities[j]);
+					argument += rule.arities[j];
+				}
+			}
+			parameters += arity;
+		}
+	}
+	//appends the rewritten current to next, split across the pool when given
+	void rewrite(const ParametricString &current, ParametricString &next, ThreadPool *pool = nullptr) const;
+};
+
+#endif // !PARAMETRIC_H
@@ -0,0 +1,166 @@
+#include "polygons.h"
+#include <cmath>
+using namespace std;
+
+/*Triangulation*/
+
+//buffers reused from polygon to polygon by the worker
+struct Scratch {
+	vector<array<double, 2>> points;
+	vector<uint32_t> previous, next;
+};
+
+//points projected on a plane, relative to the first vertex. the largest component of the newell normal picks the
+//plane the polygon folds least on, the axes are taken so that the polygon turns counterclockwise on it
+static bool project(const array<float, 3> *vertices, const size_t count, vector<array<double, 2>> *points) {
+	double normal[3] = { 0.0, 0.0, 0.0 };
+	for (size_t i = 0; i < count; i++) {
+		const array<float, 3> &a = vertices[i], &b = vertices[i + 1 == count ? 0 : i + 1];
+		normal[0] += ((double)a[1] - b[1]) * ((double)a[2] + b[2]);
+		normal[1] += ((double)a[2] - b[2]) * ((double)a[0] + b[0]);
+		normal[2] += ((double)a[0] - b[0]) * ((double)a[1] + b[1]);
+	}
+	size_t dropped = 0;
+	for (size_t axis = 1; axis < 3; axis++) {
+		if (fabs(normal[axis]) > fabs(normal[dropped]))
+			dropped = axis;
+	}
+	if (normal[dropped] == 0.0)
+		return false;
+	//the area on the plane of the next two axes has the sign of the dropped component, clockwise ones are mirrored
+	const size_t u = (dropped + 1) % 3, v = (dropped + 2) % 3;
+	const double mirror = normal[dropped] > 0.0 ? 1.0 : -1.0;
+	points->resize(count);
+	for (size_t i = 0; i < count; i++)
+		(*points)[i] = { (double)vertices[i][u] - vertices[0][u], mirror * ((double)vertices[i][v] - vertices[0][v]) };
+	return true;
+}
+
+static double turn(const array<double, 2> &a, const array<double, 2> &b, const array<double, 2> &c) {
+	return (b[0] - a[0]) * (c[1] - b[1]) - (b[1] - a[1]) * (c[0] - b[0]);
+}
+
+//counterclockwise or straight at every vertex and going around once: the direction along the first axis
+//changes sign at most twice
+static bool isConvex(const vector<array<double, 2>> &points) {
+	const size_t count = points.size();
+	unsigned int changes = 0;
+	double first = 0.0, last = 0.0;
+	for (size_t i = 0; i < count; i++) {
+		const array<double, 2> &a = points[i], &b = points[(i + 1) % count], &c = points[(i + 2) % count];
+		if (turn(a, b, c) < 0.0)
+			return false;
+		const double dx = b[0] - a[0];
+		if (dx == 0.0)
+			continue;
+		if (last != 0.0 && (dx > 0.0) != (last > 0.0))
+			changes++;
+		if (first == 0.0)
+			first = dx;
+		last = dx;
+	}
+	if (first != 0.0 && (first > 0.0) != (last > 0.0))
+		changes++;
+	return changes <= 2;
+}
+
+static bool inTriangle(const array<double, 2> &p, const array<double, 2> &a, const array<double, 2> &b, const array<double, 2> &c) {
+	return turn(a, b, p) >= 0.0 && turn(b, c, p) >= 0.0 && turn(c, a, p) >= 0.0;
+}
+
+static void triangulate(const array<float, 3> *vertices, const size_t count, Scratch &scratch, vector<array<float, 3>> *triangles) {
+	if (count < 3 || !project(vertices, count, &scratch.points))
+		return;
+	const vector<array<double, 2>> &points = scratch.points;
+	if (isConvex(points)) {
+		for (size_t i = 1; i + 1 < count; i++)
+			triangles->insert(triangles->end(), { vertices[0], vertices[i], vertices[i + 1] });
+		return;
+	}
+
+	//ear clipping: a convex corner whose triangle holds no other corner is cut off, until a triangle is left
+	vector<uint32_t> &previous = scratch.previous, &next = scratch.next;
+	previous.resize(count);
+	next.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		previous[i] = i == 0 ? (uint32_t)count - 1 : i - 1;
+		next[i] = i + 1 == count ? 0 : i + 1;
+	}
+	auto isEar = [&](const uint32_t corner) {
+		const array<double, 2> &a = points[previous[corner]], &b = points[corner], &c = points[next[corner]];
+		if (turn(a, b, c) <= 0.0)
+			return false;
+		for (uint32_t other = next[next[corner]]; other != previous[corner]; other = next[other]) {
+			const array<double, 2> &p = points[other];
+			if (p != a && p != b && p != c && inTriangle(p, a, b, c))
+				return false;
+		}
+		return true;
+	};
+	size_t remaining = count, skipped = 0;
+	uint32_t corner = 0;
+	while (remaining > 3 && skipped < remaining) {
+		if (isEar(corner)) {
+			triangles->insert(triangles->end(), { vertices[previous[corner]], vertices[corner], vertices[next[corner]] });
+			next[previous[corner]] = next[corner];
+			previous[next[corner]] = previous[corner];
+			remaining--;
+			skipped = 0;
+		}
+		else
+			skipped++;
+		corner = next[corner];
+	}
+	//the last triangle, or a self intersecting rest without ears, is fanned
+	for (uint32_t i = next[corner]; next[i] != corner; i = next[i])
+		triangles->insert(triangles->end(), { vertices[corner], vertices[i], vertices[next[i]] });
+}
+
+/*Triangulator*/
+
+Triangulator::Triangulator(vector<array<float, 3>> *triangles) : _batches(BUFFERED_BATCHES) {
+	_triangles = triangles;
+	_stalled = 0.0;
+	_polygons = 0;
+	_batch.vertices.reserve(BATCH_VERTICES);
+	_worker = thread([this]() {
+		Scratch scratch;
+		Batch batch;
+		double stalled = 0.0;
+		while (_batches.pop(batch, stalled)) {
+			const array<float, 3> *vertices = batch.vertices.data();
+			for (const uint32_t &size : batch.sizes) {
+				triangulate(vertices, size, scratch, _triangles);
+				vertices += size;
+			}
+		}
+	});
+}
+
+Triangulator::~Triangulator() { finish(); }
+
+void Triangulator::send() {
+	_batches.push(_batch, _stalled);
+	_batch.vertices.clear();
+	_batch.sizes.clear();
+	_batch.vertices.reserve(BATCH_VERTICES);
+}
+
+void Triangulator::add(const array<float, 3> *vertices, const size_t count) {
+	if (count < 3 || count > UINT32_MAX)
+		return;
+	_batch.vertices.insert(_batch.vertices.end(), vertices, vertices + count);
+	_batch.sizes.push_back((uint32_t)count);
+	_polygons++;
+	if (_batch.vertices.size() >= BATCH_VERTICES)
+		send();
+}
+
+void Triangulator::finish() {
+	if (!_worker.joinable())
+		return;
+	if (!_batch.sizes.empty())
+		send();
+	_batches.close();
+	_worker.join();
+}
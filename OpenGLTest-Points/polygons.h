@@ -0,0 +1,45 @@
+#ifndef POLYGONS_H
+#define POLYGONS_H
+
+#include <vector>
+#include <array>
+#include <thread>
+#include <cstdint>
+#include "ringbuffer.h"
+
+/*Polygon filling*/
+//polygons recorded by the turtle between { and } are triangulated on a worker thread while the turtle goes on.
+//they are sent in batches of about BATCH_VERTICES vertices, so the queue is touched once per batch and not once
+//per leaf. convex polygons are fanned from their first vertex, the others are ear clipped. every triangle goes
+//to the same list of vertices, three per triangle, drawn with a single call
+class Triangulator {
+private:
+	static constexpr size_t BATCH_VERTICES = 1 << 14;
+	static constexpr size_t BUFFERED_BATCHES = 8;
+	struct Batch {
+		std::vector<std::array<float, 3>> vertices;
+		std::vector<uint32_t> sizes; //vertices of every polygon, in order
+	};
+	std::vector<std::array<float, 3>> *_triangles; //written only by the worker until finish
+	RingBuffer<Batch> _batches;
+	Batch _batch;
+	std::thread _worker;
+	double _stalled; //seconds the turtle waited for the worker
+	unsigned long long _polygons;
+
+	void send();
+public:
+	explicit Triangulator(std::vector<std::array<float, 3>> *triangles);
+	~Triangulator();
+	Triangulator(const Triangulator &) = delete;
+	Triangulator &operator=(const Triangulator &) = delete;
+
+	//closed polygon, the last vertex is joined to the first. polygons with less than 3 vertices or no area are dropped
+	void add(const std::array<float, 3> *vertices, const size_t count);
+	//triangulates the polygons still batched and waits for the worker, triangles is then complete
+	void finish();
+	unsigned long long polygons() const { return _polygons; }
+	double stalledSeconds() const { return _stalled; }
+};
+
+#endif // !POLYGONS_H
@@ -0,0 +1,78 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+/*Bounded single producer single consumer queue*/
+//lock free: the producer only writes _tail and the consumer only writes _head, each on its own cache line.
+//the blocking push and pop yield while the queue is full or empty and add the time waited to stalled
+template<class T> class RingBuffer {
+private:
+	std::vector<T> _slots;
+	size_t _mask;
+	alignas(64) std::atomic<size_t> _head; //next slot to pop
+	alignas(64) std::atomic<size_t> _tail; //next slot to push
+	alignas(64) std::atomic<bool> _closed;
+public:
+	//capacity is rounded up to a power of two
+	explicit RingBuffer(const size_t capacity) : _head(0), _tail(0), _closed(false) {
+		size_t size = 1;
+		while (size < capacity)
+			size <<= 1;
+		_slots.resize(size);
+		_mask = size - 1;
+	}
+	RingBuffer(const RingBuffer &) = delete;
+	RingBuffer &operator=(const RingBuffer &) = delete;
+
+	//moves item into the queue, false if it is full
+	bool tryPush(T &item) {
+		const size_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head.load(std::memory_order_acquire) == _slots.size())
+			return false;
+		_slots[tail & _mask] = std::move(item);
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+	//moves the oldest item out of the queue, false if it is empty
+	bool tryPop(T &item) {
+		const size_t head = _head.load(std::memory_order_relaxed);
+		if (head == _tail.load(std::memory_order_acquire))
+			return false;
+		item = std::move(_slots[head & _mask]);
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	void push(T &item, double &stalled) {
+		if (tryPush(item))
+			return;
+		const auto start = std::chrono::steady_clock::now();
+		while (!tryPush(item))
+			std::this_thread::yield();
+		stalled += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	//false once the queue is closed and every item has been popped
+	bool pop(T &item, double &stalled) {
+		if (tryPop(item))
+			return true;
+		const auto start = std::chrono::steady_clock::now();
+		bool popped;
+		while (!(popped = tryPop(item))) {
+			if (_closed.load(std::memory_order_acquire)) {
+				popped = tryPop(item); //pushed right before closing
+				break;
+			}
+			std::this_thread::yield();
+		}
+		stalled += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return popped;
+	}
+	//called by the producer after its last push
+	void close() { _closed.store(true, std::memory_order_release); }
+};
+
+#endif // !RING_BUFFER_H
@@ -0,0 +1,410 @@
+#include "rulematcher.h"
+#include "threadpool.h"
+#include <queue>
+#include <algorithm>
+#include <functional>
+using namespace std;
+
+//below this length a generation is rewritten serially, the pool overhead would dominate
+constexpr size_t PARALLEL_REWRITE_THRESHOLD = 1 << 16;
+constexpr unsigned int CHUNKS_PER_THREAD = 4;
+
+//64 bit finalizer of splitmix64, a bijection with good avalanche
+static inline uint64_t mix64(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+RuleMatcher::RuleMatcher() {
+	_symbol_table.fill(NO_RULE);
+	_symbol_length.fill(1);
+	_max_condition_length = 1;
+	_stochastic = false;
+	_seed = 0;
+	_first_context_rule.fill(NO_RULE);
+	_context_ignored.fill(false);
+	_context_ignored['+'] = _context_ignored['-'] = true;
+	newState(0);
+}
+
+int RuleMatcher::newState(const unsigned int depth) {
+	State state;
+	state.next.fill(NO_RULE);
+	state.rule = NO_RULE;
+	state.output = NO_RULE;
+	state.depth = depth;
+	_states.push_back(state);
+	return (int)_states.size() - 1;
+}
+
+void RuleMatcher::addCondition(const string &condition, const int index) {
+	ContextRule context = { NO_CONTEXT, NO_CONTEXT, index, NO_RULE };
+	char symbol = '\0';
+	if (condition.size() == 5 && condition[1] == '<' && condition[3] == '>') {
+		context.left = condition[0];
+		symbol = condition[2];
+		context.right = condition[4];
+	}
+	else if (condition.size() == 3 && condition[1] == '<') {
+		context.left = condition[0];
+		symbol = condition[2];
+	}
+	else if (condition.size() == 3 && condition[1] == '>') {
+		symbol = condition[0];
+		context.right = condition[2];
+	}
+	if (context.left != NO_CONTEXT || context.right != NO_CONTEXT) {
+		int *link = &_first_context_rule[(unsigned char)symbol];
+		while (*link != NO_RULE)
+			link = &_context_rules[*link].next;
+		*link = (int)_context_rules.size();
+		_context_rules.push_back(context);
+	}
+	else if (condition.size() == 1) {
+		unsigned char symbol = (unsigned char)condition[0];
+		if (_symbol_table[symbol] == NO_RULE) {
+			_symbol_table[symbol] = index;
+			//alternatives of the same length still give a length known without drawing the choice
+			const Production &production = _productions[index];
+			_symbol_length[symbol] = (unsigned int)_expansions[production.first].size();
+			for (unsigned int i = production.first + 1; i < production.first + production.count; i++) {
+				if (_expansions[i].size() != _expansions[production.first].size())
+					_symbol_length[symbol] = VARIABLE_LENGTH;
+			}
+		}
+	}
+	else if (condition.size() > 1) { //empty conditions never match
+		int state = 0;
+		for (const char &current : condition) {
+			unsigned char symbol = (unsigned char)current;
+			if (_states[state].next[symbol] == NO_RULE) {
+				int created = newState(_states[state].depth + 1);
+				_states[state].next[symbol] = created;
+			}
+			state = _states[state].next[symbol];
+		}
+		if (_states[state].rule == NO_RULE)
+			_states[state].rule = index;
+		if (condition.size() > _max_condition_length)
+			_max_condition_length = (unsigned int)condition.size();
+	}
+}
+
+void RuleMatcher::compile(const vector<rule> &rules, const vector<StochasticRule> &stochasticRules) {
+	_productions.clear();
+	_expansions.clear();
+	_thresholds.clear();
+	_states.clear();
+	_symbol_table.fill(NO_RULE);
+	_symbol_length.fill(1);
+	_max_condition_length = 1;
+	_stochastic = false;
+	_context_rules.clear();
+	_first_context_rule.fill(NO_RULE);
+	newState(0);
+
+	for (const rule &rule : rules) {
+		_productions.push_back({ (unsigned int)_expansions.size(), 1 });
+		_expansions.push_back(rule.second);
+		_thresholds.push_back(1ull << 32);
+		addCondition(rule.first, (int)_productions.size() - 1);
+	}
+	for (const StochasticRule &rule : stochasticRules) {
+		double total = 0.0;
+		for (const pair<string, float> &expansion : rule.expansions)
+			total += max(0.0f, expansion.second);
+		if (rule.expansions.empty() || total <= 0.0)
+			continue;
+
+		_productions.push_back({ (unsigned int)_expansions.size(), (unsigned int)rule.expansions.size() });
+		double cumulative = 0.0;
+		for (const pair<string, float> &expansion : rule.expansions) {
+			cumulative += max(0.0f, expansion.second);
+			_expansions.push_back(expansion.first);
+			_thresholds.push_back((uint64_t)(cumulative / total * 4294967296.0));
+		}
+		_thresholds.back() = 1ull << 32; //rounding must never leave a draw without an expansion
+		if (rule.expansions.size() > 1)
+			_stochastic = true;
+		addCondition(rule.condition, (int)_productions.size() - 1);
+	}
+	//the expansion of a symbol with context rules depends on its neighbors
+	for (unsigned int symbol = 0; symbol < 256; symbol++) {
+		if (_first_context_rule[symbol] != NO_RULE)
+			_symbol_length[symbol] = VARIABLE_LENGTH;
+	}
+	if (_states.size() <= 1)
+		return;
+
+	//breadth first construction of the failure links, folded directly into the goto table
+	vector<int> failure(_states.size(), 0);
+	queue<int> pending;
+	for (int &next : _states[0].next) {
+		if (next == NO_RULE)
+			next = 0;
+		else if (next != 0) {
+			failure[next] = 0;
+			pending.push(next);
+		}
+	}
+	while (!pending.empty()) {
+		int state = pending.front();
+		pending.pop();
+		const int fallback = failure[state];
+		_states[state].output = _states[fallback].rule != NO_RULE ? fallback : _states[fallback].output;
+		for (unsigned int symbol = 0; symbol < 256; symbol++) {
+			int next = _states[state].next[symbol];
+			if (next == NO_RULE)
+				_states[state].next[symbol] = _states[fallback].next[symbol];
+			else {
+				failure[next] = _states[fallback].next[symbol];
+				pending.push(next);
+			}
+		}
+	}
+}
+
+uint64_t RuleMatcher::generationKey(const unsigned int generation) const {
+	return mix64(mix64(_seed) + generation);
+}
+
+//counter based generator: the draw for a position is the output of splitmix64 at that index of a stream
+//seeded by (seed, generation), so any chunk of a generation can be rewritten independently and still make the same choices
+const string &RuleMatcher::choose(const int index, const uint64_t key, const size_t position) const {
+	const Production &production = _productions[index];
+	if (production.count == 1)
+		return _expansions[production.first];
+	const uint64_t draw = mix64(key + position * 0x9e3779b97f4a7c15ull) >> 32;
+	//branchless scan, the choices are random and a data dependent branch would be mispredicted half the time
+	unsigned int chosen = production.first;
+	for (unsigned int i = production.first; i + 1 < production.first + production.count; i++)
+		chosen += draw >= _thresholds[i];
+	return _expansions[chosen];
+}
+
+void RuleMatcher::setContextIgnored(const string &symbols) {
+	_context_ignored.fill(false);
+	for (const char &symbol : symbols)
+		_context_ignored[(unsigned char)symbol] = true;
+}
+
+//one linear scan per direction. a [...] branch is skipped as a whole: the context met past its closing bracket
+//is the one saved when the scan entered it, the stack holds the saved contexts of the branches still open.
+//at the start of a branch the left context is the symbol before the branch, at its end there is no right context
+void RuleMatcher::buildContextIndex(const string &current, ContextIndex &contexts) const {
+	const size_t length = current.size();
+	contexts.left.resize(length);
+	contexts.right.resize(length);
+	string open;
+
+	char context = NO_CONTEXT;
+	for (size_t i = 0; i < length; i++) {
+		contexts.left[i] = context;
+		const char symbol = current[i];
+		if (symbol == '[')
+			open.push_back(context);
+		else if (symbol == ']') {
+			context = open.empty() ? NO_CONTEXT : open.back();
+			if (!open.empty())
+				open.pop_back();
+		}
+		else if (!_context_ignored[(unsigned char)symbol])
+			context = symbol;
+	}
+
+	open.clear();
+	context = NO_CONTEXT;
+	for (size_t i = length; i-- > 0;) {
+		contexts.right[i] = context;
+		const char symbol = current[i];
+		if (symbol == ']') {
+			open.push_back(context);
+			context = NO_CONTEXT;
+		}
+		else if (symbol == '[') {
+			context = open.empty() ? NO_CONTEXT : open.back();
+			if (!open.empty())
+				open.pop_back();
+		}
+		else if (!_context_ignored[(unsigned char)symbol])
+			context = symbol;
+	}
+}
+
+void RuleMatcher::rewrite(const string &current, string &next, const unsigned int generation, ThreadPool *pool) const {
+	//built once per generation, every lookup is then a single read
+	ContextIndex index;
+	const ContextIndex *contexts = nullptr;
+	if (!_context_rules.empty()) {
+		buildContextIndex(current, index);
+		contexts = &index;
+	}
+	if (_states.size() > 1) {
+		rewriteMultiCharacter(current, next, generation, contexts);
+		return;
+	}
+	if (pool != nullptr && pool->size() > 1 && current.size() >= PARALLEL_REWRITE_THRESHOLD) {
+		rewriteParallel(current, next, generation, contexts, pool);
+		return;
+	}
+	if (_stochastic || contexts != nullptr) { //the length of the output isn't known in advance, the counting pass sizes it
+		const uint64_t key = generationKey(generation);
+		next.reserve(next.size() + rewrittenLength(current, 0, current.size(), key, contexts));
+		if (contexts != nullptr) {
+			for (size_t i = 0; i < current.size(); i++) {
+				const string *expansion = expansionAt((unsigned char)current[i], i, key, contexts);
+				if (expansion == nullptr)
+					next.push_back(current[i]);
+				else
+					next.append(*expansion);
+			}
+			return;
+		}
+		//the same loop as the deterministic rules, with a choice for every rewritten symbol
+		for (size_t i = 0; i < current.size(); i++) {
+			const int index = _symbol_table[(unsigned char)current[i]];
+			if (index == NO_RULE)
+				next.push_back(current[i]);
+			else
+				next.append(choose(index, key, i));
+		}
+		return;
+	}
+	for (const char &symbol : current) {
+		const int index = _symbol_table[(unsigned char)symbol];
+		if (index == NO_RULE)
+			next.push_back(symbol);
+		else
+			next.append(_expansions[_productions[index].first]);
+	}
+}
+
+RuleMatcher RuleMatcher::power(const unsigned int steps) const {
+	if (!hasFixedExpansions())
+		return *this;
+	vector<rule> composed;
+	string current, next;
+	for (unsigned int symbol = 0; symbol < 256; symbol++) {
+		if (_symbol_table[symbol] == NO_RULE)
+			continue;
+		current.assign(1, (char)symbol);
+		for (unsigned int i = 0; i < steps; i++) {
+			next.clear();
+			rewrite(current, next);
+			current.swap(next);
+		}
+		composed.push_back(make_pair(string(1, (char)symbol), current));
+	}
+	RuleMatcher matcher;
+	matcher.compile(composed);
+	return matcher;
+}
+
+//alternatives are drawn only for the symbols whose expansions differ in length
+size_t RuleMatcher::rewrittenLength(const string &current, const size_t begin, const size_t end, const uint64_t key, const ContextIndex *contexts) const {
+	size_t count = 0;
+	for (size_t i = begin; i < end; i++) {
+		const unsigned int symbolLength = _symbol_length[(unsigned char)current[i]];
+		if (symbolLength != VARIABLE_LENGTH)
+			count += symbolLength;
+		else {
+			const string *expansion = expansionAt((unsigned char)current[i], i, key, contexts);
+			count += expansion == nullptr ? 1 : expansion->size();
+		}
+	}
+	return count;
+}
+
+//parallel prefix sum in the reduce then scan form: the first pass reduces every chunk to the length of its output,
+//the exclusive scan of those totals gives the offset of each chunk and the second pass scans the chunk locally
+//while writing the expansions directly in place. the chunk boundaries do not affect the result
+void RuleMatcher::rewriteParallel(const string &current, string &next, const unsigned int generation, const ContextIndex *contexts, ThreadPool *pool) const {
+	const size_t length = current.size();
+	const uint64_t key = generationKey(generation);
+	const size_t chunks = pool != nullptr ? (size_t)pool->size() * CHUNKS_PER_THREAD : 1;
+	const size_t chunkLength = (length + chunks - 1) / chunks;
+	vector<size_t> offsets(chunks + 1, 0);
+	auto forEachChunk = [&](const function<void(size_t)> &task) {
+		if (pool != nullptr)
+			pool->parallelFor(chunks, task);
+		else
+			task(0);
+	};
+
+	forEachChunk([&](size_t chunk) {
+		const size_t begin = min(length, chunk * chunkLength), end = min(length, begin + chunkLength);
+		offsets[chunk + 1] = rewrittenLength(current, begin, end, key, contexts);
+	});
+	for (size_t chunk = 0; chunk < chunks; chunk++)
+		offsets[chunk + 1] += offsets[chunk];
+
+	const size_t start = next.size();
+	next.resize(start + offsets[chunks]);
+	char *output = &next[0] + start;
+	forEachChunk([&](size_t chunk) {
+		const size_t begin = min(length, chunk * chunkLength), end = min(length, begin + chunkLength);
+		char *write = output + offsets[chunk];
+		for (size_t i = begin; i < end; i++) {
+			const string *expansion = expansionAt((unsigned char)current[i], i, key, contexts);
+			if (expansion == nullptr)
+				*write++ = current[i];
+			else
+				write = copy(expansion->begin(), expansion->end(), write);
+		}
+	});
+}
+
+//the match starting at a position is known once the automaton has read _max_condition_length symbols past it,
+//so the best match of the last _max_condition_length positions is kept in a ring and emitted with that delay
+void RuleMatcher::rewriteMultiCharacter(const string &current, string &next, const unsigned int generation, const ContextIndex *contexts) const {
+	const size_t length = current.size();
+	const uint64_t key = generationKey(generation);
+	const size_t window = _max_condition_length;
+	vector<unsigned int> bestLength(window);
+	vector<int> bestRule(window);
+	size_t cursor = 0; //first position not yet copied or consumed by a match
+
+	auto emit = [&](const size_t position) {
+		if (position < cursor)
+			return;
+		const size_t slot = position % window;
+		if (bestLength[slot] <= 1) { //no multi character match, the symbol is rewritten on its own
+			const string *expansion = expansionAt((unsigned char)current[position], position, key, contexts);
+			if (expansion == nullptr)
+				next.push_back(current[position]);
+			else
+				next.append(*expansion);
+			cursor = position + 1;
+		}
+		else {
+			next.append(choose(bestRule[slot], key, position));
+			cursor = position + bestLength[slot];
+		}
+	};
+
+	int state = 0;
+	for (size_t i = 0; i < length; i++) {
+		const unsigned char symbol = (unsigned char)current[i];
+		const size_t slot = i % window;
+		bestRule[slot] = _symbol_table[symbol];
+		bestLength[slot] = bestRule[slot] == NO_RULE ? 0 : 1;
+
+		state = _states[state].next[symbol];
+		for (int found = _states[state].rule != NO_RULE ? state : _states[state].output; found != NO_RULE; found = _states[found].output) {
+			const unsigned int foundLength = _states[found].depth;
+			const size_t start = (i + 1 - foundLength) % window;
+			if (foundLength > bestLength[start]) {
+				bestLength[start] = foundLength;
+				bestRule[start] = _states[found].rule;
+			}
+		}
+
+		if (i + 1 >= window)
+			emit(i + 1 - window);
+	}
+	for (size_t position = length >= window ? length + 1 - window : 0; position < length; position++)
+		emit(position);
+}
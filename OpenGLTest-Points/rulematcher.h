@@ -0,0 +1,131 @@
+#ifndef RULE_MATCHER_H
+#define RULE_MATCHER_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+
+typedef std::pair<std::string, std::string> rule;
+class ThreadPool;
+
+//a condition with several weighted expansions, every occurrence picks one of them
+struct StochasticRule {
+	std::string condition;
+	std::vector<std::pair<std::string, float>> expansions; //expansion, weight
+};
+
+/*Compiled rule set*/
+//single character conditions are looked up in a table, longer ones matched by an Aho-Corasick automaton.
+//the leftmost, then longest, then first declared match wins and is consumed whole, deterministic rules first.
+//l<s, s>r and l<s>r rewrite s only in that context, before its context free rule
+class RuleMatcher {
+private:
+	static constexpr int NO_RULE = -1;
+	static constexpr unsigned int VARIABLE_LENGTH = ~0u;
+
+	struct State {
+		std::array<int, 256> next; //goto function completed with the failure links
+		int rule; //rule whose condition ends exactly in this state
+		int output; //nearest state on the failure chain with a rule
+		unsigned int depth; //length of the prefix represented by the state
+	};
+	struct Production {
+		unsigned int first, count; //range of the rule expansions in _expansions
+	};
+	struct ContextRule {
+		char left, right; //NO_CONTEXT matches any context
+		int rule;
+		int next; //next declared context rule for the same symbol
+	};
+	//context of every position of a generation: the nearest symbol on its left and on its right along the
+	//same branch, skipping ignored symbols and whole [...] branches. NO_CONTEXT at the ends of a branch
+	struct ContextIndex {
+		std::string left, right;
+	};
+	static constexpr char NO_CONTEXT = '\0';
+
+	std::vector<Production> _productions; //indexed by rule
+	std::vector<std::string> _expansions;
+	std::vector<uint64_t> _thresholds; //cumulative probability of every expansion, scaled to 2^32
+	std::array<int, 256> _symbol_table; //single character condition -> rule
+	std::array<unsigned int, 256> _symbol_length; //length of the rewritten symbol, 1 if no rule applies
+	std::vector<State> _states; //automaton for the multi character conditions, state 0 is the root
+	std::vector<ContextRule> _context_rules;
+	std::array<int, 256> _first_context_rule; //symbol -> first declared context rule
+	std::array<bool, 256> _context_ignored; //symbols skipped when looking for a context, + and - by default
+	unsigned int _max_condition_length;
+	bool _stochastic;
+	uint64_t _seed;
+
+	int newState(const unsigned int depth);
+	void addCondition(const std::string &condition, const int index);
+	uint64_t generationKey(const unsigned int generation) const;
+	//expansion of the rule at a position of the generation, the choice depends only on (seed, generation, position)
+	const std::string &choose(const int index, const uint64_t key, const size_t position) const;
+	//expansion of the single symbol at a position, nullptr if no rule rewrites it
+	const std::string *expansionAt(const unsigned char symbol, const size_t position, const uint64_t key, const ContextIndex *contexts) const {
+		for (int context = _first_context_rule[symbol]; context != NO_RULE; context = _context_rules[context].next) {
+			const ContextRule &rule = _context_rules[context];
+			if ((rule.left == NO_CONTEXT || rule.left == contexts->left[position]) && (rule.right == NO_CONTEXT || rule.right == contexts->right[position]))
+				return &choose(rule.rule, key, position);
+		}
+		const int index = _symbol_table[symbol];
+		return index == NO_RULE ? nullptr : &choose(index, key, position);
+	}
+	//length of the rewritten symbols from begin to end
+	size_t rewrittenLength(const std::string &current, const size_t begin, const size_t end, const uint64_t key, const ContextIndex *contexts) const;
+	void buildContextIndex(const std::string &current, ContextIndex &contexts) const;
+	void rewriteMultiCharacter(const std::string &current, std::string &next, const unsigned int generation, const ContextIndex *contexts) const;
+	void rewriteParallel(const std::string &current, std::string &next, const unsigned int generation, const ContextIndex *contexts, ThreadPool *pool) const;
+public:
+	RuleMatcher();
+	void compile(const std::vector<rule> &rules, const std::vector<StochasticRule> &stochasticRules = std::vector<StochasticRule>());
+	void setSeed(const uint64_t seed) { _seed = seed; }
+	//symbols skipped when looking for the context of a symbol
+	void setContextIgnored(const std::string &symbols);
+	//appends the rewritten current to next, split across the pool when given and the rules allow it.
+	//generation is the number of iterations that produced current, it only matters to stochastic rules
+	void rewrite(const std::string &current, std::string &next, const unsigned int generation = 0, ThreadPool *pool = nullptr) const;
+	//calls visitor(symbol) for every symbol of the rewritten current as soon as it is produced, the rewritten
+	//generation is never stored. multi character conditions still rewrite it in a temporary string first
+	template<class Visitor> void visit(const std::string &current, const unsigned int generation, Visitor &&visitor) const {
+		if (_states.size() > 1) {
+			std::string next;
+			rewrite(current, next, generation);
+			for (const char &symbol : next)
+				visitor(symbol);
+			return;
+		}
+		ContextIndex index;
+		const ContextIndex *contexts = nullptr;
+		if (!_context_rules.empty()) {
+			buildContextIndex(current, index);
+			contexts = &index;
+		}
+		const uint64_t key = generationKey(generation);
+		for (size_t i = 0; i < current.size(); i++) {
+			const std::string *expansion = expansionAt((unsigned char)current[i], i, key, contexts);
+			if (expansion == nullptr)
+				visitor(current[i]);
+			else {
+				for (const char &symbol : *expansion)
+					visitor(symbol);
+			}
+		}
+	}
+	//rules mapping every symbol directly to its expansion after steps iterations, fixed expansions only
+	RuleMatcher power(const unsigned int steps) const;
+
+	//true when all conditions are single characters without context, every symbol can then be rewritten on its own
+	bool isContextFree() const { return _states.size() <= 1 && _context_rules.empty(); }
+	bool isStochastic() const { return _stochastic; }
+	//true when every symbol always rewrites to the same expansion, wherever it appears
+	bool hasFixedExpansions() const { return isContextFree() && !isStochastic(); }
+	//expansion of a single symbol, nullptr if no rule rewrites it. meaningful with fixed expansions only
+	const std::string *expansion(const unsigned char symbol) const {
+		return _symbol_table[symbol] == NO_RULE ? nullptr : &_expansions[_productions[_symbol_table[symbol]].first];
+	}
+};
+
+#endif // !RULE_MATCHER_H
@@ -0,0 +1,68 @@
+#include "threadpool.h"
+using namespace std;
+
+ThreadPool::ThreadPool(const unsigned int threads) {
+	_task = nullptr;
+	_task_count = 0;
+	_next_task = 0;
+	_busy_workers = 0;
+	_generation = 0;
+	_stopping = false;
+	for (unsigned int i = 1; i < threads; i++)
+		_workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wake.notify_all();
+	for (thread &worker : _workers)
+		worker.join();
+}
+
+void ThreadPool::runTasks() {
+	for (size_t i = _next_task.fetch_add(1); i < _task_count; i = _next_task.fetch_add(1))
+		(*_task)(i);
+}
+
+void ThreadPool::workerLoop() {
+	unsigned long long seen = 0;
+	while (true) {
+		unique_lock<mutex> lock(_mutex);
+		_wake.wait(lock, [&] { return _stopping || _generation != seen; });
+		if (_stopping)
+			return;
+		seen = _generation;
+		lock.unlock();
+
+		runTasks();
+
+		lock.lock();
+		if (--_busy_workers == 0)
+			_done.notify_all();
+	}
+}
+
+void ThreadPool::parallelFor(const size_t count, const function<void(size_t)> &task) {
+	if (_workers.empty() || count <= 1) {
+		for (size_t i = 0; i < count; i++)
+			task(i);
+		return;
+	}
+	{
+		lock_guard<mutex> lock(_mutex);
+		_task = &task;
+		_task_count = count;
+		_next_task = 0;
+		_busy_workers = _workers.size();
+		_generation++;
+	}
+	_wake.notify_all();
+	runTasks();
+
+	unique_lock<mutex> lock(_mutex);
+	_done.wait(lock, [&] { return _busy_workers == 0; });
+	_task = nullptr;
+}
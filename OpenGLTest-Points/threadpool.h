@@ -0,0 +1,38 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/*Fixed size pool of worker threads*/
+//the thread calling parallelFor works together with the pool and returns only when every task is done
+class ThreadPool {
+private:
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	std::condition_variable _wake, _done;
+	const std::function<void(size_t)> *_task;
+	size_t _task_count;
+	std::atomic<size_t> _next_task;
+	size_t _busy_workers;
+	unsigned long long _generation; //incremented for every parallelFor call
+	bool _stopping;
+
+	void workerLoop();
+	void runTasks();
+public:
+	ThreadPool(const unsigned int threads); //total number of threads, caller included
+	~ThreadPool();
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	unsigned int size() const { return (unsigned int)_workers.size() + 1; }
+	//runs task(0) ... task(count - 1), tasks are picked dynamically by the free threads
+	void parallelFor(const size_t count, const std::function<void(size_t)> &task);
+};
+
+#endif // !THREAD_POOL_H
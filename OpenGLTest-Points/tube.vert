@@ -0,0 +1,24 @@
+// Vertex Shader - file "tube.vert"
+
+#version 330
+
+uniform mat4 mvp;
+
+in  vec3 in_Position; //cylinder of radius 1 along z from 0 to 1
+in  vec3 in_Start;
+in  vec3 in_End;
+in  float in_Radius;
+out vec3 ex_Color;
+
+void main(void)
+{
+	//the directions across the axis tessellateTubes uses
+	vec3 axis = in_End - in_Start;
+	vec3 helper = abs(axis.z) < 0.9 * length(axis) ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+	vec3 side = normalize(cross(axis, helper));
+	vec3 other = normalize(cross(axis, side));
+	vec3 normal = in_Position.x * side + in_Position.y * other;
+	//green lit from the upper right of the viewer
+	ex_Color = vec3(0.0, 0.3 + 0.7 * max(dot(normal, normalize(vec3(0.4, 0.6, 1.0))), 0.0), 0.0);
+	gl_Position = mvp * vec4(in_Start + in_Position.z * axis + in_Radius * normal, 1.0);
+}
@@ -0,0 +1,93 @@
+#include "tubes.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cmath>
+#include <gtc/packing.hpp>
+using namespace std;
+
+constexpr size_t TUBES_PER_TASK = 1 << 12;
+constexpr double FULL_CIRCLE = 6.283185307179586476925;
+
+static array<float, 3> cross(const array<float, 3> &a, const array<float, 3> &b) {
+	return { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+}
+
+static array<float, 3> normalized(const array<float, 3> &v) {
+	const float length = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	return length > 0.0f ? array<float, 3>{ v[0] / length, v[1] / length, v[2] / length } : array<float, 3>{ 0.0f, 0.0f, 0.0f };
+}
+
+/*Instances*/
+
+void buildTubes(const vector<array<float, 3>> &segments, const vector<VertexAttributes> &attributes, const TubeOptions &options, vector<TubeInstance> *tubes) {
+	const size_t count = min(segments.size(), attributes.size()) / 2;
+	//every vertex of a segment has its attributes, those of the first are taken
+	auto depthOf = [&](const size_t segment) { return (size_t)attributes[2 * segment].depth; };
+	size_t deepest = 0;
+	for (size_t i = 0; i < count; i++)
+		deepest = max(deepest, depthOf(i));
+	//counting sort by depth, stable so the tubes of a depth keep the order they were drawn in
+	vector<size_t> first(deepest + 2, 0);
+	for (size_t i = 0; i < count; i++)
+		first[depthOf(i) + 1]++;
+	for (size_t depth = 1; depth < first.size(); depth++)
+		first[depth] += first[depth - 1];
+	vector<float> radii(deepest + 1);
+	for (size_t depth = 0; depth < radii.size(); depth++)
+		radii[depth] = options.radius * pow(options.taper, (float)depth);
+
+	tubes->resize(count);
+	for (size_t i = 0; i < count; i++)
+		(*tubes)[first[depthOf(i)]++] = { segments[2 * i], segments[2 * i + 1], radii[depthOf(i)] * glm::unpackHalf1x16(attributes[2 * i].width) };
+}
+
+/*Meshes*/
+
+void cylinderMesh(const unsigned int sides, vector<array<float, 3>> *vertices, vector<uint32_t> *indices) {
+	vertices->clear();
+	indices->clear();
+	for (unsigned int side = 0; side < sides; side++) {
+		const double alpha = FULL_CIRCLE * side / sides;
+		vertices->push_back({ (float)cos(alpha), (float)sin(alpha), 0.0f });
+		vertices->push_back({ (float)cos(alpha), (float)sin(alpha), 1.0f });
+	}
+	for (uint32_t side = 0; side < sides; side++) {
+		const uint32_t bottom = 2 * side, top = bottom + 1, nextBottom = 2 * ((side + 1) % sides), nextTop = nextBottom + 1;
+		indices->insert(indices->end(), { bottom, nextBottom, top, top, nextBottom, nextTop });
+	}
+}
+
+void tessellateTubes(const vector<TubeInstance> &tubes, const unsigned int sides, ThreadPool *pool, vector<array<float, 3>> *triangles) {
+	vector<array<float, 3>> circle;
+	vector<uint32_t> indices;
+	cylinderMesh(sides, &circle, &indices);
+	const size_t first = triangles->size();
+	triangles->resize(first + tubes.size() * indices.size());
+
+	auto tessellate = [&](const size_t task) {
+		const size_t last = min(tubes.size(), (task + 1) * TUBES_PER_TASK);
+		array<float, 3> *output = triangles->data() + first + task * TUBES_PER_TASK * indices.size();
+		for (size_t i = task * TUBES_PER_TASK; i < last; i++) {
+			const TubeInstance &tube = tubes[i];
+			const array<float, 3> axis = { tube.end[0] - tube.start[0], tube.end[1] - tube.start[1], tube.end[2] - tube.start[2] };
+			//any direction not too close to the axis gives the two directions across it
+			const float length = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+			const array<float, 3> helper = fabs(axis[2]) < 0.9f * length ? array<float, 3>{ 0.0f, 0.0f, 1.0f } : array<float, 3>{ 1.0f, 0.0f, 0.0f };
+			const array<float, 3> side = normalized(cross(axis, helper));
+			const array<float, 3> other = normalized(cross(axis, side));
+			for (const uint32_t &index : indices) {
+				const array<float, 3> &point = circle[index];
+				for (unsigned int k = 0; k < 3; k++)
+					(*output)[k] = tube.start[k] + point[2] * axis[k] + tube.radius * (point[0] * side[k] + point[1] * other[k]);
+				output++;
+			}
+		}
+	};
+	const size_t tasks = (tubes.size() + TUBES_PER_TASK - 1) / TUBES_PER_TASK;
+	if (pool == nullptr || pool->size() <= 1) {
+		for (size_t task = 0; task < tasks; task++)
+			tessellate(task);
+	}
+	else
+		pool->parallelFor(tasks, tessellate);
+}
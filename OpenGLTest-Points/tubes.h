@@ -0,0 +1,30 @@
+#ifndef TUBES_H
+#define TUBES_H
+
+#include <vector>
+#include <array>
+#include <cstdint>
+#include "geometry.h"
+
+class ThreadPool;
+
+/*Branch tubes*/
+//segments drawn as tapered tubes. every segment is an instance of one shared cylinder, stretched from its start
+//to its end and scaled by a radius that shrinks with its bracket depth and follows its width, so the memory stays
+//proportional to the segments and not to the sides of the cylinder. the instances are ordered by depth: the tubes
+//of a depth are contiguous and can be drawn with a level of detail of their own
+struct TubeOptions {
+	float radius = 0.1f; //of segments outside brackets and of width 1, in segment lengths
+	float taper = 0.75f; //ratio between the radius of a bracket depth and the one outside it
+	unsigned int sides = 8; //of the cylinder
+};
+
+//segments are pairs of vertices, attributes those of each vertex with the depth and the width (see turtle.h)
+void buildTubes(const std::vector<std::array<float, 3>> &segments, const std::vector<VertexAttributes> &attributes, const TubeOptions &options, std::vector<TubeInstance> *tubes);
+//cylinder of radius 1 along z from 0 to 1 without caps, as indexed triangles
+void cylinderMesh(const unsigned int sides, std::vector<std::array<float, 3>> *vertices, std::vector<uint32_t> *indices);
+//flat triangle mesh of the tubes for export, 6 * sides vertices per tube appended to triangles, tessellated in
+//parallel on the pool. the cylinders are oriented as the tube shader orients the instances
+void tessellateTubes(const std::vector<TubeInstance> &tubes, const unsigned int sides, ThreadPool *pool, std::vector<std::array<float, 3>> *triangles);
+
+#endif // !TUBES_H
@@ -0,0 +1,280 @@
+#include "turtle.h"
+#include "threadpool.h"
+#include "polygons.h"
+using namespace std;
+
+constexpr size_t PARALLEL_TURTLE_THRESHOLD = 1 << 16;
+constexpr unsigned int CHUNKS_PER_THREAD = 4;
+constexpr double FULL_CIRCLE = 6.283185307179586476925;
+
+/*Turtle*/
+
+template<unsigned int ATTRIBUTES> BasicTurtle<ATTRIBUTES>::BasicTurtle(const string &drawing_variables, const float starting_angle, const float turning_angle, vector<array<float, 3>> *vertices) {
+	_drawing_variables = drawing_variables;
+	_starting_angle = starting_angle;
+	_turning_angle = turning_angle;
+	_position = { 0.0f, 0.0f, 0.0f };
+	_heading = 0;
+	_free_angle = 0.0f;
+	_vertices = vertices;
+	_output = nullptr;
+	_emitted = 0;
+	_attributes = nullptr;
+	_attribute_output = nullptr;
+	_depth_base = 0;
+	setWidth(1.0f);
+	_color = 0;
+	_unmatched_pops = 0;
+	_merge_collinear = false;
+	_extending = false;
+	_three_dimensional = false;
+	_starting_frame = { Direction(1.0f, 0.0f, 0.0f, 0.0f), Direction(0.0f, 1.0f, 0.0f, 0.0f), Direction(0.0f, 0.0f, 1.0f, 0.0f) };
+	_frame = _starting_frame;
+	_rotation_axis = YAW;
+	_rotation_turns = 0;
+	_unnormalized_rotations = 0;
+	_polygons = nullptr;
+
+	//smallest number of turns that makes whole circles, allowing for the rounding of the angle to a float.
+	//the table then uses the exact fraction of the circle, so the period closes on itself
+	_period = 0;
+	_circles = 0;
+	for (long long turns = 1; turns <= MAX_PERIOD && _period == 0; turns++) {
+		const double angle = turns * _turning_angle;
+		const double nearest = floor(angle / FULL_CIRCLE + 0.5);
+		if (fabs(angle - nearest * FULL_CIRCLE) <= turns * fabs(_turning_angle) * 1e-7 + 1e-12) {
+			_period = turns;
+			_circles = (long long)nearest;
+		}
+	}
+	//square lattice for periods dividing 4 turns, triangular for periods dividing 6, along the starting direction
+	//and the one a quarter or a sixth of a circle to its left
+	_cell = { 0, 0 };
+	_sides = _period == 0 ? 0 : (4 % _period == 0 ? 4 : (6 % _period == 0 ? 6 : 0));
+	_lattice = _sides != 0;
+	if (_lattice) {
+		//a starting angle rounded to a float from a multiple of the lattice angle is taken as that multiple
+		const double sector = FULL_CIRCLE / _sides;
+		const double nearest = floor(_starting_angle / sector + 0.5);
+		if (fabs(_starting_angle - nearest * sector) <= fabs(_starting_angle) * 1e-7 + 1e-12)
+			_starting_angle = nearest * sector;
+		for (long long axis = 0; axis < 2; axis++) {
+			const double alpha = _starting_angle + FULL_CIRCLE * axis / _sides;
+			_basis[(size_t)axis] = { fabs(cos(alpha)) < 1e-12 ? 0.0 : cos(alpha), fabs(sin(alpha)) < 1e-12 ? 0.0 : sin(alpha) };
+		}
+		const array<long long, 2> square[4] = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 } };
+		const array<long long, 2> triangular[6] = { { 1, 0 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { 0, -1 }, { 1, -1 } };
+		_steps.resize((size_t)_period);
+		for (long long heading = 0; heading < _period; heading++) {
+			long long side = (heading * _circles) % _period * (_sides / _period);
+			if (side < 0)
+				side += _sides;
+			_steps[(size_t)heading] = _sides == 4 ? square[side] : triangular[side];
+		}
+	}
+	if (_period != 0) {
+		_directions.resize((size_t)_period);
+		for (long long heading = 0; heading < _period; heading++) {
+			const double alpha = _starting_angle + FULL_CIRCLE * (double)((heading * _circles) % _period) / _period;
+			_directions[(size_t)heading] = { (float)cos(alpha), (float)sin(alpha) };
+		}
+	}
+	else {
+		_directions.resize((size_t)(2 * UNPERIODIC_TURNS + 1));
+		for (long long heading = -UNPERIODIC_TURNS; heading <= UNPERIODIC_TURNS; heading++) {
+			const double alpha = _starting_angle + heading * _turning_angle;
+			_directions[(size_t)(heading + UNPERIODIC_TURNS)] = { (float)cos(alpha), (float)sin(alpha) };
+		}
+	}
+}
+
+template<unsigned int ATTRIBUTES> void BasicTurtle<ATTRIBUTES>::setThreeDimensional(const bool three_dimensional) {
+	_three_dimensional = three_dimensional;
+	_lattice = !three_dimensional && _sides != 0;
+	_rotations.clear();
+	if (!three_dimensional)
+		return;
+	//like the directions, with the exact fraction of the circle when periodic. right angles give exact zeros,
+	//so axis aligned frames stay exact
+	auto exact = [](const double value) { return fabs(value) < 1e-12 ? 0.0f : (float)value; };
+	double start = _starting_angle;
+	if (_period != 0) {
+		_rotations.resize((size_t)_period);
+		for (long long turns = 0; turns < _period; turns++) {
+			const double alpha = FULL_CIRCLE * (double)((turns * _circles) % _period) / _period;
+			_rotations[(size_t)turns] = { exact(cos(alpha)), exact(sin(alpha)) };
+		}
+		//a starting angle rounded to a float from a multiple of the turning angle is taken as that multiple
+		const double sector = FULL_CIRCLE / _period;
+		const double nearest = floor(start / sector + 0.5);
+		if (fabs(start - nearest * sector) <= fabs(start) * 1e-7 + 1e-12)
+			start = nearest * sector;
+	}
+	else {
+		_rotations.resize((size_t)(2 * UNPERIODIC_TURNS + 1));
+		for (long long turns = -UNPERIODIC_TURNS; turns <= UNPERIODIC_TURNS; turns++)
+			_rotations[(size_t)(turns + UNPERIODIC_TURNS)] = { (float)cos(turns * _turning_angle), (float)sin(turns * _turning_angle) };
+	}
+	const float c = exact(cos(start)), s = exact(sin(start));
+	_starting_frame = { Direction(c, s, 0.0f, 0.0f), Direction(-s, c, 0.0f, 0.0f), Direction(0.0f, 0.0f, 1.0f, 0.0f) };
+	_frame = _starting_frame;
+	_rotation_turns = 0;
+	_unnormalized_rotations = 0;
+}
+
+//only lattice states are composed, the integer steps make it exact
+template<unsigned int ATTRIBUTES> typename BasicTurtle<ATTRIBUTES>::State BasicTurtle<ATTRIBUTES>::compose(const State &base, const State &relative) const {
+	State composed;
+	composed.heading = (base.heading + relative.heading) % _period;
+	composed.free_angle = base.free_angle + relative.free_angle;
+	//' without parameters adds to the color index
+	if constexpr (COLORS) {
+		composed.width = base.width;
+		composed.half_width = base.half_width;
+		composed.color = (uint8_t)(base.color + relative.color);
+	}
+	composed.frame = base.frame;
+	//rotation by the base heading: the first axis goes to its step, the second to that step turned by one side
+	const array<long long, 2> &first = _steps[(size_t)base.heading];
+	const array<long long, 2> second = _sides == 4 ? array<long long, 2>{ -first[1], first[0] } : array<long long, 2>{ -first[1], first[0] + first[1] };
+	composed.cell = { base.cell[0] + relative.cell[0] * first[0] + relative.cell[1] * second[0],
+		base.cell[1] + relative.cell[0] * first[1] + relative.cell[1] * second[1] };
+	composed.position = { (float)(composed.cell[0] * _basis[0][0] + composed.cell[1] * _basis[1][0]),
+		(float)(composed.cell[0] * _basis[0][1] + composed.cell[1] * _basis[1][1]), 0.0f };
+	return composed;
+}
+
+template<unsigned int ATTRIBUTES> void BasicTurtle<ATTRIBUTES>::consumePolygon(const char symbol) {
+	_extending = false;
+	if (symbol == '{')
+		_polygon_starts.push_back(_polygon_vertices.size());
+	else if (_polygon_starts.empty())
+		return;
+	else if (symbol == '.') {
+		//a position added twice in a row would only give triangles without area
+		if (_polygon_vertices.size() == _polygon_starts.back() || _polygon_vertices.back() != _position)
+			_polygon_vertices.push_back(_position);
+	}
+	else {
+		const size_t start = _polygon_starts.back();
+		_polygon_starts.pop_back();
+		_polygons->add(_polygon_vertices.data() + start, _polygon_vertices.size() - start);
+		_polygon_vertices.resize(start);
+	}
+}
+
+template<unsigned int ATTRIBUTES> void BasicTurtle<ATTRIBUTES>::consumeAll(const string &symbols, ThreadPool *pool) {
+	//float positions and widths would round differently when composed, those turtles interpret in order
+	if (pool == nullptr || pool->size() <= 1 || symbols.size() < PARALLEL_TURTLE_THRESHOLD || _polygons != nullptr || !_lattice || WIDTHS) {
+		for (const char &symbol : symbols)
+			consume(symbol);
+		return;
+	}
+	//a segment open at the end of a chunk is extended by the moves the next chunk starts with, as when
+	//interpreted in order. the scouts count vertices as if every chunk continued such a segment
+	struct Summary {
+		size_t vertices, pops;
+		vector<State> pushes; //states left on the stack, relative to the state after the last pop
+		State end; //relative to the state after the last pop, or to the starting state without pops
+		bool leads; //moves before any symbol that ends a segment, they extend the open one
+		bool breaks; //a symbol ends a segment, then extending tells whether one is open at the end
+		bool extending;
+	};
+	const size_t chunks = (size_t)pool->size() * CHUNKS_PER_THREAD;
+	const size_t chunkSize = (symbols.size() + chunks - 1) / chunks;
+	vector<Summary> summaries(chunks);
+	pool->parallelFor(chunks, [&](const size_t chunk) {
+		BasicTurtle scout(*this);
+		scout._stack.clear();
+		scout.setState(zeroState());
+		scout._vertices = nullptr;
+		scout._output = nullptr;
+		scout._emitted = 0;
+		scout._unmatched_pops = 0;
+		scout._extending = _merge_collinear;
+		const size_t first = min(symbols.size(), chunk * chunkSize), last = min(symbols.size(), first + chunkSize);
+		bool leads = false;
+		size_t i = first;
+		for (; i < last && scout._extending; i++) {
+			leads = leads || _drawing_variables.find(symbols[i]) != string::npos;
+			scout.consume(symbols[i]);
+		}
+		const bool breaks = !scout._extending;
+		for (; i < last; i++)
+			scout.consume(symbols[i]);
+		summaries[chunk] = { scout._emitted, scout._unmatched_pops, move(scout._stack), scout.state(), leads, breaks, scout._extending };
+	});
+
+	//starting state, popped stack entries and vertex offset of every chunk, in order
+	vector<State> starts(chunks);
+	vector<vector<State>> popped(chunks);
+	vector<size_t> offsets(chunks);
+	vector<size_t> depthBases(chunks); //saved states below the ones each chunk pops, for the depth of its vertices
+	vector<bool> joins(chunks); //the chunk starts by extending the segment open at the end of the previous ones
+	State current = state();
+	size_t vertices = _vertices->size();
+	bool extending = _extending;
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		const Summary &summary = summaries[chunk];
+		starts[chunk] = current;
+		joins[chunk] = extending && summary.leads;
+		offsets[chunk] = vertices;
+		vertices += summary.vertices;
+		//without an open segment the first move emits both of its vertices
+		if (summary.leads && !extending)
+			vertices += 2;
+		extending = summary.breaks ? summary.extending : extending || summary.leads;
+		const size_t available = min(summary.pops, _stack.size());
+		depthBases[chunk] = _depth_base + _stack.size() - available;
+		popped[chunk].assign(_stack.end() - available, _stack.end());
+		State base = current;
+		if (summary.pops > 0) {
+			//more pops than saved states reset the turtle, as they do when interpreted
+			base = summary.pops > available ? zeroState() : _stack[_stack.size() - summary.pops];
+			_stack.resize(_stack.size() - available);
+		}
+		for (const State &pushed : summary.pushes)
+			_stack.push_back(compose(base, pushed));
+		current = compose(base, summary.end);
+	}
+
+	_vertices->resize(vertices);
+	if (ATTRIBUTES != 0)
+		_attributes->resize(vertices);
+	vector<State> ends(chunks);
+	//end of the segment a chunk extends, it is the last vertex of the previous chunks and is set once they are written
+	vector<array<float, 3>> joined(chunks);
+	pool->parallelFor(chunks, [&](const size_t chunk) {
+		BasicTurtle writer(*this);
+		writer._stack = move(popped[chunk]);
+		writer.setState(starts[chunk]);
+		writer._attribute_output = ATTRIBUTES != 0 ? _attributes->data() + offsets[chunk] : nullptr;
+		writer._depth_base = depthBases[chunk];
+		writer._extending = joins[chunk];
+		writer._output = &joined[chunk] + 1;
+		const size_t first = min(symbols.size(), chunk * chunkSize), last = min(symbols.size(), first + chunkSize);
+		size_t i = first;
+		for (; i < last && writer._extending; i++)
+			writer.consume(symbols[i]);
+		writer._output = _vertices->data() + offsets[chunk];
+		for (; i < last; i++)
+			writer.consume(symbols[i]);
+		ends[chunk] = writer.state();
+	});
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		if (joins[chunk])
+			(*_vertices)[offsets[chunk] - 1] = joined[chunk];
+	}
+	//the state composed from the summaries can differ from the interpreted one by rounding
+	setState(ends[chunks - 1]);
+	_extending = extending;
+}
+
+template class BasicTurtle<0>;
+template class BasicTurtle<ATTRIBUTE_DEPTH>;
+template class BasicTurtle<ATTRIBUTE_WIDTH>;
+template class BasicTurtle<ATTRIBUTE_DEPTH | ATTRIBUTE_WIDTH>;
+template class BasicTurtle<ATTRIBUTE_COLOR>;
+template class BasicTurtle<ATTRIBUTE_DEPTH | ATTRIBUTE_COLOR>;
+template class BasicTurtle<ATTRIBUTE_WIDTH | ATTRIBUTE_COLOR>;
+template class BasicTurtle<ATTRIBUTE_ALL>;
@@ -0,0 +1,458 @@
+#ifndef TURTLE_H
+#define TURTLE_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+#include <vec4.hpp>
+#include <geometric.hpp>
+#include <gtc/type_aligned.hpp>
+#include <gtc/packing.hpp>
+#include "geometry.h"
+
+class ThreadPool;
+class Triangulator;
+
+constexpr float DEGREES_TO_RADIANS = 3.14159265358979323846f / 180.0f;
+
+/*Turtle interpretation*/
+//consumes the symbols of a generation one at a time and appends two vertices for every drawing variable.
+//the heading is a whole number of turns read from a table, and with turns of 90 or 60 degrees the position stays
+//on an integer lattice, so neither accumulates rounding errors.
+//& ^ \ / | turn a frame in space (see setThreeDimensional) and { . } record polygons (see setPolygons).
+//ATTRIBUTES are VertexAttribute flags: the bracket depth, the width changed by ! and the color index by '
+template<unsigned int ATTRIBUTES> class BasicTurtle {
+private:
+	static constexpr long long UNPERIODIC_TURNS = 4096;
+	static constexpr long long MAX_PERIOD = 4096;
+	static constexpr unsigned int ORTHONORMALIZE_ROTATIONS = 64; //rotations between corrections of the frame
+	static constexpr float WIDTH_FACTOR = 0.7f;
+	static constexpr bool WIDTHS = (ATTRIBUTES & ATTRIBUTE_WIDTH) != 0;
+	static constexpr bool COLORS = (ATTRIBUTES & ATTRIBUTE_COLOR) != 0;
+	enum RotationAxis { YAW, PITCH, ROLL };
+	typedef glm::aligned_vec4 Direction; //xyz, w is 0
+	struct Frame {
+		Direction heading, left, up;
+	};
+	struct NoAttributes {};
+	struct Attributes {
+		float width;
+		uint16_t half_width; //width as a half float
+		uint8_t color;
+	};
+	//the width and the color index are saved only when they are given to the vertices
+	struct State : std::conditional_t<WIDTHS || COLORS, Attributes, NoAttributes> {
+		std::array<float, 3> position;
+		std::array<long long, 2> cell;
+		long long heading;
+		float free_angle;
+		Frame frame;
+	};
+	std::vector<State> _stack;
+	std::string _drawing_variables;
+	double _starting_angle, _turning_angle;
+	std::array<float, 3> _position;
+	long long _heading; //turns, in [0, _period) when periodic
+	float _free_angle; //radians turned by parametric modules, not a number of turns
+	long long _period; //0 if no number of turns up to MAX_PERIOD makes a full circle
+	std::vector<std::array<float, 2>> _directions; //cos, sin by heading, offset by UNPERIODIC_TURNS if not periodic
+	bool _lattice; //the position is _cell
+	std::array<long long, 2> _cell; //lattice coordinates along _basis
+	std::array<std::array<double, 2>, 2> _basis;
+	std::vector<std::array<long long, 2>> _steps; //lattice step by heading
+	long long _sides, _circles; //lattice sides, 0 if not on a lattice, and full circles made by a period of turns
+	std::vector<std::array<float, 3>> *_vertices;
+	std::array<float, 3> *_output; //when set the vertices are written here instead of appended to _vertices
+	size_t _emitted; //vertices counted without output
+	std::vector<VertexAttributes> *_attributes; //of every vertex, appended with it
+	VertexAttributes *_attribute_output; //written alongside _output
+	size_t _depth_base; //saved states below _stack, for chunks interpreted with only the states they pop
+	float _width;
+	uint16_t _half_width;
+	uint8_t _color;
+	size_t _unmatched_pops; //] with an empty stack, the turtle is then reset to the zero state
+	bool _merge_collinear;
+	bool _extending; //the last vertex emitted is the end of a segment the next move can extend
+	bool _three_dimensional;
+	Frame _frame, _starting_frame;
+	std::vector<std::array<float, 2>> _rotations; //cos, sin by number of turns, indexed as _directions
+	RotationAxis _rotation_axis;
+	long long _rotation_turns; //turns about _rotation_axis not yet applied to _frame
+	unsigned int _unnormalized_rotations;
+	Triangulator *_polygons;
+	std::vector<std::array<float, 3>> _polygon_vertices; //of the open polygons, nested ones after the one they are in
+	std::vector<size_t> _polygon_starts; //first vertex of every open polygon
+
+	void emit() {
+		if (_output != nullptr) {
+			*_output++ = _position;
+			if constexpr (ATTRIBUTES != 0)
+				*_attribute_output++ = attributes();
+		}
+		else if (_vertices != nullptr) {
+			_vertices->push_back(_position);
+			if constexpr (ATTRIBUTES != 0)
+				_attributes->push_back(attributes());
+		}
+		else
+			_emitted++;
+	}
+	VertexAttributes attributes() const {
+		VertexAttributes packed = { 0, 0, 0 };
+		if constexpr ((ATTRIBUTES & ATTRIBUTE_DEPTH) != 0)
+			packed.depth = (uint8_t)std::min<size_t>(_depth_base + _stack.size(), UINT8_MAX);
+		if constexpr (COLORS)
+			packed.color = _color;
+		if constexpr (WIDTHS)
+			packed.width = _half_width;
+		return packed;
+	}
+	//a move continuing the last segment in the same direction moves its end instead of starting a new one
+	void beginSegment() {
+		if (!_extending && _polygon_starts.empty())
+			emit();
+	}
+	void endSegment() {
+		if (!_polygon_starts.empty())
+			return;
+		if (!_extending) {
+			emit();
+			_extending = _merge_collinear;
+		}
+		else if (_output != nullptr)
+			_output[-1] = _position;
+		else if (_vertices != nullptr)
+			_vertices->back() = _position;
+	}
+	State state() {
+		flushRotation();
+		State current = { {}, _position, _cell, _heading, _free_angle, _frame };
+		if constexpr (WIDTHS || COLORS) {
+			current.width = _width;
+			current.half_width = _half_width;
+			current.color = _color;
+		}
+		return current;
+	}
+	State zeroState() const {
+		State zero = { {}, { 0.0f, 0.0f, 0.0f }, { 0, 0 }, 0, 0.0f, _starting_frame };
+		if constexpr (WIDTHS || COLORS) {
+			zero.width = 1.0f;
+			zero.half_width = glm::packHalf1x16(1.0f);
+			zero.color = 0;
+		}
+		return zero;
+	}
+	void setState(const State &state) {
+		_position = state.position;
+		_cell = state.cell;
+		_heading = state.heading;
+		_free_angle = state.free_angle;
+		_frame = state.frame;
+		_rotation_turns = 0;
+		if constexpr (WIDTHS) {
+			_width = state.width;
+			_half_width = state.half_width;
+		}
+		if constexpr (COLORS)
+			_color = state.color;
+	}
+	//state reached by applying relative, reached from the zero state, to base
+	State compose(const State &base, const State &relative) const;
+
+	std::array<float, 2> direction() const {
+		if (_free_angle == 0.0f) {
+			if (_period != 0)
+				return _directions[(size_t)_heading];
+			if (_heading >= -UNPERIODIC_TURNS && _heading <= UNPERIODIC_TURNS)
+				return _directions[(size_t)(_heading + UNPERIODIC_TURNS)];
+		}
+		const double alpha = _starting_angle + _heading * _turning_angle + _free_angle;
+		return { (float)cos(alpha), (float)sin(alpha) };
+	}
+	//a whole number of turns reduced to less than a full circle
+	long long turnsOf(const unsigned long long count) const { return _period != 0 ? (long long)(count % _period) : (long long)count; }
+	void turn(const long long turns) {
+		_extending = false;
+		if (_three_dimensional) {
+			rotate(YAW, turns);
+			return;
+		}
+		_heading += turns;
+		if (_period != 0 && (_heading < 0 || _heading >= _period)) {
+			_heading %= _period;
+			if (_heading < 0)
+				_heading += _period;
+		}
+	}
+	void moveOnLattice(const long long count) {
+		_cell[0] += count * _steps[(size_t)_heading][0];
+		_cell[1] += count * _steps[(size_t)_heading][1];
+		_position = { (float)(_cell[0] * _basis[0][0] + _cell[1] * _basis[1][0]), (float)(_cell[0] * _basis[0][1] + _cell[1] * _basis[1][1]), 0.0f };
+	}
+	void draw(const float length) {
+		if (_three_dimensional) {
+			beginSegment();
+			advance(length);
+			endSegment();
+			return;
+		}
+		const std::array<float, 2> heading = direction();
+		beginSegment();
+		_position = { _position[0] + length * heading[0], _position[1] + length * heading[1], 0.0f };
+		endSegment();
+	}
+
+	/*Frame*/
+	std::array<float, 2> rotation(const long long turns) const {
+		if (_period != 0)
+			return _rotations[(size_t)(turns % _period + (turns % _period < 0 ? _period : 0))];
+		if (turns >= -UNPERIODIC_TURNS && turns <= UNPERIODIC_TURNS)
+			return _rotations[(size_t)(turns + UNPERIODIC_TURNS)];
+		return { (float)cos(turns * _turning_angle), (float)sin(turns * _turning_angle) };
+	}
+	//turns the heading towards left for yaw, towards up for pitch and left towards up for roll
+	void applyRotation(const RotationAxis axis, const float c, const float s) {
+		Direction &from = axis == ROLL ? _frame.left : _frame.heading;
+		Direction &to = axis == YAW ? _frame.left : _frame.up;
+		const Direction turned = c * from + s * to;
+		to = c * to - s * from;
+		from = turned;
+		if (++_unnormalized_rotations == ORTHONORMALIZE_ROTATIONS)
+			orthonormalize();
+	}
+	//rounding makes the directions drift from unit length and right angles, they are corrected
+	//every ORTHONORMALIZE_ROTATIONS rotations. exact frames, as with right angles, stay exact
+	void orthonormalize() {
+		_unnormalized_rotations = 0;
+		_frame.heading *= 1.0f / sqrt(glm::dot(_frame.heading, _frame.heading));
+		_frame.left -= glm::dot(_frame.left, _frame.heading) * _frame.heading;
+		_frame.left *= 1.0f / sqrt(glm::dot(_frame.left, _frame.left));
+		_frame.up = Direction(glm::cross(glm::vec3(_frame.heading), glm::vec3(_frame.left)), 0.0f);
+	}
+	void flushRotation() {
+		if (_rotation_turns == 0)
+			return;
+		const std::array<float, 2> turned = rotation(_rotation_turns);
+		_rotation_turns = 0;
+		applyRotation(_rotation_axis, turned[0], turned[1]);
+	}
+	void rotate(const RotationAxis axis, const long long turns) {
+		_extending = false;
+		if (axis != _rotation_axis) {
+			flushRotation();
+			_rotation_axis = axis;
+		}
+		_rotation_turns += turns;
+	}
+	//half a circle about up, which commutes with a pending yaw
+	void turnAround() {
+		_extending = false;
+		if (_rotation_axis != YAW)
+			flushRotation();
+		_frame.heading = -_frame.heading;
+		_frame.left = -_frame.left;
+	}
+	void advance(const float length) {
+		flushRotation();
+		_position = { _position[0] + length * _frame.heading.x, _position[1] + length * _frame.heading.y, _position[2] + length * _frame.heading.z };
+	}
+	//axis and sense of the turns of & ^ \ /, false for other symbols
+	static bool spatialTurn(const char symbol, RotationAxis *axis, long long *sense) {
+		switch (symbol) {
+		case '&': *axis = PITCH; *sense = -1; return true;
+		case '^': *axis = PITCH; *sense = 1; return true;
+		case '\\': *axis = ROLL; *sense = -1; return true;
+		case '/': *axis = ROLL; *sense = 1; return true;
+		default: return false;
+		}
+	}
+	void consumePolygon(const char symbol);
+	//! and ', or set to value
+	void consumeAttribute(const char symbol) {
+		_extending = false;
+		if (symbol == '!' && WIDTHS)
+			setWidth(_width * WIDTH_FACTOR);
+		else if (symbol == '\'' && COLORS)
+			_color++;
+	}
+	void setAttribute(const char symbol, const float value) {
+		_extending = false;
+		if (symbol == '!' && WIDTHS)
+			setWidth(value);
+		else if (symbol == '\'' && COLORS)
+			_color = (uint8_t)std::min(std::max(value, 0.0f), 255.0f);
+	}
+	void setWidth(const float width) {
+		_width = width;
+		_half_width = glm::packHalf1x16(width);
+	}
+	void consumeSpatial(const char symbol) {
+		RotationAxis axis;
+		long long sense;
+		if (spatialTurn(symbol, &axis, &sense))
+			rotate(axis, sense * turnsOf(1));
+		else if (symbol == '|')
+			turnAround();
+	}
+public:
+	BasicTurtle(const std::string &drawing_variables, const float starting_angle, const float turning_angle, std::vector<std::array<float, 3>> *vertices);
+
+	//consecutive moves in the same direction, with only symbols that don't affect the turtle between them,
+	//are emitted as a single segment. off by default
+	void setMergeCollinear(const bool merge) {
+		_merge_collinear = merge;
+		_extending = false;
+	}
+	//appends the ATTRIBUTES of every vertex to attributes, required when there are any. set before the first symbol
+	void setAttributes(std::vector<VertexAttributes> *attributes) { _attributes = attributes; }
+	//interprets & ^ \ / | and moves in space, set before the first symbol. the starting frame heads along the
+	//starting angle in the xy plane with up towards z, so symbols that stay in the plane draw as before
+	void setThreeDimensional(const bool three_dimensional);
+	//sends the polygons between { and } to polygons, set before the first symbol. polygons still open at the
+	//end are dropped
+	void setPolygons(Triangulator *polygons) { _polygons = polygons; }
+
+	/*Primitives*/
+	//a single move of a drawing variable
+	void step() {
+		beginSegment();
+		if (_lattice)
+			moveOnLattice(1);
+		else if (_three_dimensional)
+			advance(1.0f);
+		else {
+			const std::array<float, 2> heading = direction();
+			_position = { _position[0] + heading[0], _position[1] + heading[1], 0.0f };
+		}
+		endSegment();
+	}
+	//count moves of a drawing variable, the same vertices as count steps. a merged lattice run moves at once
+	void forward(const unsigned long long count) {
+		if (_lattice && _merge_collinear) {
+			beginSegment();
+			moveOnLattice((long long)count);
+			endSegment();
+			return;
+		}
+		for (unsigned long long i = 0; i < count; i++)
+			step();
+	}
+	//turns to the left, to the right when negative
+	void turnBy(const long long turns) { turn(turns < 0 ? -turnsOf(0ull - (unsigned long long)turns) : turnsOf((unsigned long long)turns)); }
+	//[] with nothing between, ends the segment and applies the pending rotation as saving the state does
+	void emptyBranch() {
+		_extending = false;
+		flushRotation();
+	}
+	void push() {
+		_extending = false;
+		_stack.push_back(state());
+	}
+	void pop() {
+		_extending = false;
+		if (_stack.empty()) {
+			_unmatched_pops++;
+			setState(zeroState());
+		}
+		else {
+			setState(_stack.back());
+			_stack.pop_back();
+		}
+	}
+
+	/*Symbols*/
+	void consume(const char symbol) {
+		//if is a drawing variable set new points
+		if (_drawing_variables.find(symbol) != std::string::npos)
+			step();
+		else if (symbol == '[')
+			push();
+		else if (symbol == ']')
+			pop();
+		else if (symbol == '+') {
+			turn(1);
+		}
+		else if (symbol == '-') {
+			turn(-1);
+		}
+		else if (symbol == '{' || symbol == '.' || symbol == '}') {
+			if (_polygons != nullptr)
+				consumePolygon(symbol);
+		}
+		else if ((WIDTHS || COLORS) && (symbol == '!' || symbol == '\''))
+			consumeAttribute(symbol);
+		else if (_three_dimensional)
+			consumeSpatial(symbol);
+	}
+
+	//parametric module: the first parameter of a drawing variable is the length of its segment,
+	//the first parameter of + and - and of the spatial turns is the turning angle in degrees, the one of ! the
+	//width and the one of ' the color index. other modules ignore their parameters
+	void consume(const char symbol, const float *parameters, const unsigned int arity) {
+		RotationAxis axis;
+		long long sense;
+		if (arity == 0)
+			consume(symbol);
+		else if (_three_dimensional && (symbol == '+' || symbol == '-' || spatialTurn(symbol, &axis, &sense))) {
+			if (symbol == '+' || symbol == '-') {
+				axis = YAW;
+				sense = symbol == '+' ? 1 : -1;
+			}
+			const float angle = sense * parameters[0] * DEGREES_TO_RADIANS;
+			flushRotation();
+			_extending = false;
+			applyRotation(axis, cos(angle), sin(angle));
+		}
+		else if (_drawing_variables.find(symbol) != std::string::npos) {
+			_lattice = false;
+			draw(parameters[0]);
+		}
+		else if (symbol == '+') {
+			_lattice = false;
+			_extending = false;
+			_free_angle += parameters[0] * DEGREES_TO_RADIANS;
+		}
+		else if (symbol == '-') {
+			_lattice = false;
+			_extending = false;
+			_free_angle -= parameters[0] * DEGREES_TO_RADIANS;
+		}
+		else if ((WIDTHS || COLORS) && (symbol == '!' || symbol == '\''))
+			setAttribute(symbol, parameters[0]);
+		else
+			consume(symbol);
+	}
+
+	//a run has the effect of its symbol repeated count times, only moves and turns are folded
+	void consumeRun(const char symbol, const unsigned long long count) {
+		RotationAxis axis;
+		long long sense;
+		if (count == 1)
+			consume(symbol);
+		else if (_drawing_variables.find(symbol) != std::string::npos)
+			forward(count);
+		else if (symbol == '+')
+			turn(turnsOf(count));
+		else if (symbol == '-')
+			turn(-turnsOf(count));
+		else if (_three_dimensional && spatialTurn(symbol, &axis, &sense))
+			rotate(axis, sense * turnsOf(count));
+		else {
+			for (unsigned long long i = 0; i < count; i++)
+				consume(symbol);
+		}
+	}
+
+	//consumes a string without parameters, long lattice strings in parallel chunks with the same vertices
+	//as in order. with polygons, widths or float positions it is interpreted in order
+	void consumeAll(const std::string &symbols, ThreadPool *pool = nullptr);
+};
+
+typedef BasicTurtle<0> Turtle;
+
+#endif // !TURTLE_H
@@ -0,0 +1,96 @@
+#include "turtleprogram.h"
+using namespace std;
+
+TurtleProgram::TurtleProgram(const string &drawing_variables) {
+	_opcodes.fill(NONE);
+	for (const char &symbol : drawing_variables)
+		_opcodes[(uint8_t)symbol] = FORWARD;
+	_opcodes['+'] = TURN;
+	_opcodes['-'] = TURN;
+	_opcodes['['] = PUSH;
+	_opcodes[']'] = POP;
+	for (const char *symbol = OTHER_SYMBOLS; *symbol != '\0'; symbol++)
+		_opcodes[(uint8_t)*symbol] = RUN;
+	_symbols = 0;
+	_pending = NONE;
+	_pending_count = 0;
+	_pending_turns = 0;
+	_pending_symbol = '\0';
+}
+
+void TurtleProgram::flush() {
+	switch (_pending) {
+	case FORWARD:
+		for (; _pending_count > MAX_OPERAND; _pending_count -= MAX_OPERAND)
+			emit(FORWARD, (uint32_t)MAX_OPERAND);
+		emit(FORWARD, (uint32_t)_pending_count);
+		break;
+	case TURN:
+		for (; _pending_turns > MAX_TURNS; _pending_turns -= MAX_TURNS)
+			emit(TURN, (uint32_t)MAX_TURNS);
+		for (; _pending_turns < -MAX_TURNS; _pending_turns += MAX_TURNS)
+			emit(TURN, (uint32_t)-MAX_TURNS);
+		emit(TURN, (uint32_t)_pending_turns);
+		break;
+	case RUN:
+		for (; _pending_count > MAX_REPETITIONS; _pending_count -= MAX_REPETITIONS)
+			emit(RUN, (uint8_t)_pending_symbol | (uint32_t)MAX_REPETITIONS << 8);
+		emit(RUN, (uint8_t)_pending_symbol | (uint32_t)_pending_count << 8);
+		break;
+	default:
+		break;
+	}
+	_pending = NONE;
+	_pending_count = 0;
+	_pending_turns = 0;
+}
+
+void TurtleProgram::addRun(const char symbol, const unsigned long long count) {
+	_symbols += count;
+	switch (_opcodes[(uint8_t)symbol]) {
+	case FORWARD:
+		if (_pending != FORWARD)
+			flush();
+		_pending = FORWARD;
+		_pending_count += count;
+		break;
+	case TURN:
+		if (_pending != TURN)
+			flush();
+		_pending = TURN;
+		_pending_turns += symbol == '+' ? (long long)count : -(long long)count;
+		break;
+	case PUSH:
+		flush();
+		for (unsigned long long i = 0; i < count; i++)
+			emit(PUSH, 0);
+		break;
+	case POP:
+		for (unsigned long long i = 0; i < count; i++) {
+			flush();
+			//an empty branch only ends the segment, consecutive ones end it once
+			if (!_instructions.empty() && _instructions.back() == PUSH) {
+				_instructions.pop_back();
+				if (_instructions.empty() || _instructions.back() != BREAK)
+					emit(BREAK, 0);
+			}
+			else
+				emit(POP, 0);
+		}
+		break;
+	case RUN:
+		if (_pending != RUN || _pending_symbol != symbol)
+			flush();
+		_pending = RUN;
+		_pending_symbol = symbol;
+		_pending_count += count;
+		break;
+	default:
+		break;
+	}
+}
+
+void TurtleProgram::finish() {
+	flush();
+	_instructions.shrink_to_fit();
+}
@@ -0,0 +1,79 @@
+#ifndef TURTLE_PROGRAM_H
+#define TURTLE_PROGRAM_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+
+/*Turtle programs*/
+//a generation compiled into 32 bit turtle instructions, opcode in the low bits. runs of moves and turns are
+//folded. the program doesn't depend on the angles, so it is interpreted again when only those change
+class TurtleProgram {
+public:
+	enum Opcode : uint32_t {
+		FORWARD, //operand moves of the drawing variables
+		TURN, //signed operand, turns to the left. kept when it is 0, a turn ends the segment
+		PUSH,
+		POP,
+		RUN, //the other turtle symbols: the symbol in the low 8 bits of the operand and its repetitions above them
+		BREAK, //an empty branch
+		NONE, //nothing folded yet, never emitted
+	};
+private:
+	static constexpr unsigned int OPCODE_BITS = 3;
+	static constexpr uint32_t OPCODE_MASK = (1u << OPCODE_BITS) - 1;
+	static constexpr unsigned long long MAX_OPERAND = (1ull << (32 - OPCODE_BITS)) - 1;
+	static constexpr long long MAX_TURNS = (long long)(MAX_OPERAND >> 1);
+	static constexpr unsigned long long MAX_REPETITIONS = MAX_OPERAND >> 8;
+	//symbols of the other turtle modes, interpreted only by the turtles in those modes
+	static constexpr const char *OTHER_SYMBOLS = "&^\\/|{.}!'";
+	std::vector<uint32_t> _instructions;
+	std::array<Opcode, 256> _opcodes; //of every symbol, NONE for the dropped ones, FORWARD and TURN for + as well as -
+	unsigned long long _symbols;
+	//run being folded
+	Opcode _pending;
+	unsigned long long _pending_count;
+	long long _pending_turns;
+	char _pending_symbol;
+
+	void emit(const Opcode opcode, const uint32_t operand) { _instructions.push_back(opcode | operand << OPCODE_BITS); }
+	void flush();
+public:
+	explicit TurtleProgram(const std::string &drawing_variables);
+
+	void add(const char symbol) { addRun(symbol, 1); }
+	void addRun(const char symbol, const unsigned long long count);
+	//emits the run still being folded, called after the last symbol
+	void finish();
+
+	size_t size() const { return _instructions.size(); }
+	unsigned long long symbols() const { return _symbols; }
+
+	//drives any turtle with forward, turnBy, push, pop, emptyBranch and consumeRun
+	template<class Turtle> void run(Turtle &turtle) const {
+		for (const uint32_t &instruction : _instructions) {
+			switch (instruction & OPCODE_MASK) {
+			case FORWARD:
+				turtle.forward(instruction >> OPCODE_BITS);
+				break;
+			case TURN:
+				turtle.turnBy((int32_t)instruction >> OPCODE_BITS);
+				break;
+			case PUSH:
+				turtle.push();
+				break;
+			case POP:
+				turtle.pop();
+				break;
+			case BREAK:
+				turtle.emptyBranch();
+				break;
+			default:
+				turtle.consumeRun((char)(instruction >> OPCODE_BITS), instruction >> (OPCODE_BITS + 8));
+			}
+		}
+	}
+};
+
+#endif // !TURTLE_PROGRAM_H
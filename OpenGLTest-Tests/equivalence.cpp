@@ -0,0 +1,116 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <array>
+#include <string>
+#include <memory>
+#include "lsystem.h"
+using namespace std;
+
+//every preset must give the same vertices, bit for bit, with every derivation strategy, thread count and
+//interpretation mode as with the eager strategy interpreted in order on one thread
+
+struct Preset {
+	LSystemCode code;
+	unsigned int iterations; //at least 100K symbols, enough to be interpreted in parallel chunks
+};
+
+static const Preset PRESETS[] = {
+	{ FRACTAL_TREE, 14 }, { SIERPINSKI_TRIANGLE, 10 }, { SIERPINSKI_TRIANGLE_AH, 10 }, { DRAGON_CURVE, 15 },
+	{ FRACTAL_PLANT, 7 }, { HILBERT_CURVE, 8 }, { SIMPLE_CURVE1, 5 }, { SIMPLE_CURVE2, 5 },
+	{ BUSHES1, 9 }, { BUSHES2, 6 }, { BUSHES3, 5 }, { BUSHES4, 13 }, { CRYSTALS, 6 }, { SNOWFLAKE1, 7 },
+	{ BUSHES3D, 8 }, { LEAFY_PLANT, 7 },
+};
+static const char *STRATEGY_NAMES[] = { "eager", "lazy", "dag", "kstep", "packed", "rle" };
+constexpr unsigned int THREADS = 4;
+
+static unsigned int failures = 0;
+
+static unique_ptr<LSystem> create(const Preset &preset, const bool merge, const DerivationStrategy strategy = DERIVE_EAGER, const unsigned int threads = 1) {
+	unique_ptr<LSystem> lsystem(getDefaultLSystems(preset.code));
+	lsystem->setMergeCollinear(merge);
+	lsystem->setDerivationStrategy(strategy);
+	lsystem->setThreadCount(threads);
+	return lsystem;
+}
+
+template<class T> static string bytes(const vector<T> &items) {
+	return string((const char*)items.data(), sizeof(T) * items.size());
+}
+
+//vertices of the status, taking ownership of the array
+static string take(vector<array<float, 3>> *vertices) {
+	const string taken = bytes(*vertices);
+	delete vertices;
+	return taken;
+}
+
+static void check(const Preset &preset, const bool merge, const string &what, const string &expected, const string &actual) {
+	if (expected == actual)
+		return;
+	failures++;
+	cout << "FAIL preset " << preset.code << " merge " << (merge ? "on" : "off") << ": " << what << " differs (" <<
+		actual.size() << " bytes, expected " << expected.size() << ")" << endl;
+}
+
+/*Checks*/
+
+static void checkStrategies(const Preset &preset, const bool merge, const string &expected, const string &status) {
+	for (unsigned int strategy = DERIVE_LAZY; strategy <= DERIVE_RLE; strategy++) {
+		unique_ptr<LSystem> lsystem = create(preset, merge, (DerivationStrategy)strategy);
+		lsystem->doIterations(preset.iterations);
+		check(preset, merge, string(STRATEGY_NAMES[strategy]) + " vertices", expected, take(lsystem->translateStatus()));
+		check(preset, merge, string(STRATEGY_NAMES[strategy]) + " status", status, lsystem->getStatus());
+	}
+}
+
+static void checkFused(const Preset &preset, const bool merge, const string &expected) {
+	unique_ptr<LSystem> lsystem = create(preset, merge);
+	lsystem->doIterations(preset.iterations - 1);
+	check(preset, merge, "fused vertices", expected, take(lsystem->translateNextGeneration()));
+}
+
+static void checkThreads(const Preset &preset, const bool merge, const string &expected) {
+	vector<VertexAttributes> sequential, parallel;
+	unique_ptr<LSystem> lsystem = create(preset, merge);
+	lsystem->doIterations(preset.iterations);
+	check(preset, merge, "attributed vertices", expected, take(lsystem->translateStatus(ATTRIBUTE_ALL, &sequential)));
+	lsystem = create(preset, merge, DERIVE_EAGER, THREADS);
+	lsystem->doIterations(preset.iterations);
+	check(preset, merge, "threaded vertices", expected, take(lsystem->translateStatus(ATTRIBUTE_ALL, &parallel)));
+	check(preset, merge, "threaded attributes", bytes(sequential), bytes(parallel));
+}
+
+static void checkPipelined(const Preset &preset, const bool merge, const string &expected) {
+	unique_ptr<LSystem> lsystem = create(preset, merge);
+	lsystem->doIterations(preset.iterations - 1);
+	ostringstream file;
+	array<PipelineStage, 3> stages;
+	lsystem->writeNextGeneration(file, &stages);
+	check(preset, merge, "pipelined file", expected, file.str());
+}
+
+static void checkCompiled(const Preset &preset, const bool merge, const string &expected) {
+	unique_ptr<LSystem> lsystem = create(preset, merge);
+	lsystem->doIterations(preset.iterations);
+	lsystem->compileTurtleProgram();
+	check(preset, merge, "compiled vertices", expected, take(lsystem->translateStatus()));
+}
+
+int main() {
+	for (const Preset &preset : PRESETS) {
+		for (const bool merge : { false, true }) {
+			unique_ptr<LSystem> reference = create(preset, merge);
+			reference->doIterations(preset.iterations);
+			const string expected = take(reference->translateStatus());
+			checkStrategies(preset, merge, expected, reference->getStatus());
+			checkFused(preset, merge, expected);
+			checkThreads(preset, merge, expected);
+			checkPipelined(preset, merge, expected);
+			checkCompiled(preset, merge, expected);
+		}
+	}
+	if (failures == 0)
+		cout << "All equivalence checks passed" << endl;
+	return failures == 0 ? 0 : 1;
+}